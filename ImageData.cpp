@@ -1,213 +1,776 @@
+#include <emmintrin.h>
+#include <string.h>
+
 #include "ImageData.h"
 #include "math.h"
+#include "parallel.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
-RGBA AlphaBlend(const RGBA& A, const RGBA& B, float alpha)
+// Blending is done in fixed point, with the coverage of a pixel given as a pair of weights: weight1 for the color
+// being drawn and weight0 = c_blendWeightOne - weight1 for what is already there. The weights sum to 2^14 * 256 / 255
+// rather than 2^14, which folds the 256 / 255 scale of converting a blended value in [0, 255] back to 8 bits (a
+// multiply by 256 and a clamp of the value as a fraction of 255) into the blend itself. Blending opaque pixels is then
+// (old * weight0 + new * weight1 + c_blendRounding) >> 14 for each channel, saturated to 255, which SSE2 does with one multiply-add
+// per pixel.
+//
+// The exact weight sum is 16448.25, so a blend can come out up to 64 / 2^14 of a step low before the shift truncates
+// it like the float blend does. c_blendRounding adds back half of that, centering the error rather than always
+// rounding down. A full half step would be too much: it would take even a weight of 0 up a step.
+static const int c_blendWeightShift = 14;
+static const int c_blendWeightOne = 16448;
+static const int c_blendRounding = 32;
+
+// The coverage of a pixel at a squared distance of index / c_coverageLUTScale from a line, as weight1, for every
+// squared distance up to 4, along with how much it changes by up to the next entry. It's the SmoothStep falloff the
+// lines have always had, out to 2 pixels. Interpolating between the entries either side of a squared distance is
+// within a hundredth of an 8 bit step of the exact falloff, and needs no square root.
+static const int c_coverageLUTScale = 256;
+static const int c_coverageLUTSize = 4 * c_coverageLUTScale + 1;
+
+struct CoverageLUTEntry
+{
+    float m_weight;
+    float m_slope;
+};
+
+static const CoverageLUTEntry* GetCoverageLUT()
 {
-    // alpha blends using premultiplied alpha for correct results
-    Vec4 v4a = {
-        float(A.R) / 255.0f,
-        float(A.G) / 255.0f,
-        float(A.B) / 255.0f,
-        float(A.A) / 255.0f
+    struct CoverageLUT
+    {
+        CoverageLUTEntry m_entries[c_coverageLUTSize];
+
+        CoverageLUT()
+        {
+            auto weight = [] (int index)
+            {
+                float alpha = SmoothStep((float)sqrt(double(index) / double(c_coverageLUTScale)), 2.0f, 0.0f);
+                return float(double(alpha) * double(c_blendWeightOne));
+            };
+
+            for (int index = 0; index < c_coverageLUTSize; ++index)
+            {
+                m_entries[index].m_weight = weight(index);
+                m_entries[index].m_slope = weight(index + 1) - weight(index);
+            }
+        }
     };
-    v4a[0] *= v4a[3];
-    v4a[1] *= v4a[3];
-    v4a[2] *= v4a[3];
-
-    Vec4 v4b = {
-        float(B.R) / 255.0f,
-        float(B.G) / 255.0f,
-        float(B.B) / 255.0f,
-        float(B.A) / 255.0f
+    static const CoverageLUT lut;
+    return lut.m_entries;
+}
+
+// Alpha blends B over A with premultiplied alpha, for correct results with transparent pixels too. The un-premultiply
+// divides by the blended alpha, with the 256 / 255 scale folded in. The weight sum cancels out of that division, so
+// it is already the float blend's result, truncated, and only the alpha needs c_blendRounding.
+static RGBA AlphaBlend(const RGBA& A, const RGBA& B, int weight1)
+{
+    const int64_t weight0 = c_blendWeightOne - weight1;
+    const int64_t alphaA = A.A;
+    const int64_t alphaB = B.A;
+
+    const int64_t blendedAlpha = alphaA * weight0 + alphaB * weight1;
+    if (blendedAlpha == 0)
+        return RGBA{ 0, 0, 0, 0 };
+
+    auto channel = [&] (uint8 a, uint8 b)
+    {
+        int64_t premultiplied = int64_t(a) * alphaA * weight0 + int64_t(b) * alphaB * weight1;
+        return (uint8)std::min<int64_t>(premultiplied * 256 / (blendedAlpha * 255), 255);
     };
-    v4b[0] *= v4b[3];
-    v4b[1] *= v4b[3];
-    v4b[2] *= v4b[3];
 
-    Vec4 blended;
-    for (int index = 0; index < 4; ++index)
-        blended[index] = Lerp(v4a[index], v4b[index], alpha);
+    RGBA ret;
+    ret.R = channel(A.R, B.R);
+    ret.G = channel(A.G, B.G);
+    ret.B = channel(A.B, B.B);
+    ret.A = (uint8)std::min<int64_t>((blendedAlpha + c_blendRounding) >> c_blendWeightShift, 255);
+    return ret;
+}
+
+// Blends color over pixels[0] to pixels[count - 1] (count <= 4), pixel i with weights[i] as its weight1, where
+// pixels has room for available (>= count) pixels. Opaque pixels under an opaque color blend four at a time with
+// SSE2, and anything else one pixel at a time. A weight of 0 leaves an opaque pixel as it is, so pixels past count
+// with a weight of 0 can go through the SSE2 blend too, and it only needs a copy when there isn't room for four.
+static void BlendPixels4(RGBA* pixels, int count, int available, const RGBA& color, const int weights[4])
+{
+    if (color.A == 255)
+    {
+        RGBA block[4] = { { 0, 0, 0, 255 }, { 0, 0, 0, 255 }, { 0, 0, 0, 255 }, { 0, 0, 0, 255 } };
+        RGBA* target = pixels;
+        if (available < 4)
+        {
+            std::copy(pixels, pixels + count, block);
+            target = block;
+        }
+
+        __m128i destination = _mm_loadu_si128((const __m128i*)target);
+        const __m128i alphaMask = _mm_set1_epi32(int(0xff000000));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(destination, alphaMask), alphaMask)) == 0xffff)
+        {
+            // (old, new) channel pairs, for _mm_madd_epi16 to weight and add
+            const __m128i zero = _mm_setzero_si128();
+            uint32_t colorBits;
+            memcpy(&colorBits, &color, sizeof(colorBits));
+            const __m128i colorWords = _mm_unpacklo_epi8(_mm_set1_epi32(int(colorBits)), zero);
+            const __m128i destinationLow = _mm_unpacklo_epi8(destination, zero);
+            const __m128i destinationHigh = _mm_unpackhi_epi8(destination, zero);
+
+            const __m128i rounding = _mm_set1_epi32(c_blendRounding);
+            __m128i blended[4];
+            const __m128i pairs[4] = {
+                _mm_unpacklo_epi16(destinationLow, colorWords),
+                _mm_unpackhi_epi16(destinationLow, colorWords),
+                _mm_unpacklo_epi16(destinationHigh, colorWords),
+                _mm_unpackhi_epi16(destinationHigh, colorWords)
+            };
+            for (int index = 0; index < 4; ++index)
+            {
+                __m128i weightPair = _mm_set1_epi32((c_blendWeightOne - weights[index]) | (weights[index] << 16));
+                blended[index] = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(pairs[index], weightPair), rounding), c_blendWeightShift);
+            }
+
+            __m128i words = _mm_packs_epi32(blended[0], blended[1]);
+            __m128i words2 = _mm_packs_epi32(blended[2], blended[3]);
+            _mm_storeu_si128((__m128i*)target, _mm_packus_epi16(words, words2));
+            if (available < 4)
+                std::copy(block, block + count, pixels);
+            return;
+        }
+    }
 
-    if (blended[3] > 0.0f)
+    for (int index = 0; index < count; ++index)
     {
-        blended[0] /= blended[3];
-        blended[1] /= blended[3];
-        blended[2] /= blended[3];
+        if (weights[index] > 0)
+            pixels[index] = AlphaBlend(pixels[index], color, weights[index]);
     }
-    else
+}
+
+// Narrows [left, right] to the x where lo <= c * x + offset <= hi
+static void IntersectLinear(double c, double offset, double lo, double hi, double& left, double& right)
+{
+    if (fabs(c) < 1e-12)
     {
-        blended = Vec4{ 0.0f, 0.0f, 0.0f, 0.0f };
+        if (offset < lo || offset > hi)
+            right = left - 1.0;
+        return;
     }
 
-    RGBA ret;
-    ret.R = (uint8)Clamp(blended[0] * 256.0f, 0.0f, 255.0f);
-    ret.G = (uint8)Clamp(blended[1] * 256.0f, 0.0f, 255.0f);
-    ret.B = (uint8)Clamp(blended[2] * 256.0f, 0.0f, 255.0f);
-    ret.A = (uint8)Clamp(blended[3] * 256.0f, 0.0f, 255.0f);
-    return ret;
+    double a = (lo - offset) / c;
+    double b = (hi - offset) / c;
+    left = std::max(left, std::min(a, b));
+    right = std::min(right, std::max(a, b));
 }
 
-void SImageData::DrawLine(int x1, int y1, int x2, int y2, const RGBA& color)
+// Calls lambda(iy, ix, count, weights) for the pixels a line from (x1, y1) to (x2, y2) covers within the clip
+// rectangle [clipX1, clipX2] x [clipY1, clipY2], four at a time along each row: weights[i] is the coverage of pixel
+// ix + i for i < count, and 0 for the lanes past that. Groups of four pixels with no coverage are skipped.
+template <typename LAMBDA>
+static void ForEachLineCoverage(int x1, int y1, int x2, int y2, int clipX1, int clipY1, int clipX2, int clipY2, const LAMBDA& lambda)
 {
     // pad the AABB of pixels we scan, to account for anti aliasing
-    int startX = std::max(std::min(x1, x2) - 4, 0);
-    int startY = std::max(std::min(y1, y2) - 4, 0);
-    int endX = std::min(std::max(x1, x2) + 4, (int)m_width - 1);
-    int endY = std::min(std::max(y1, y2) + 4, (int)m_height - 1);
+    int startX = std::max(std::min(x1, x2) - 4, clipX1);
+    int startY = std::max(std::min(y1, y2) - 4, clipY1);
+    int endX = std::min(std::max(x1, x2) + 4, clipX2);
+    int endY = std::min(std::max(y1, y2) + 4, clipY2);
 
     // if (x1,y1) is A and (x2,y2) is B, get a normalized vector from A to B called AB
     float ABX = float(x2 - x1);
     float ABY = float(y2 - y1);
     float ABLen = (float)sqrt(ABX * ABX + ABY * ABY);
+
+    // a zero length line has no direction, and draws nothing
+    if (ABLen == 0.0f)
+        return;
+
     ABX /= ABLen;
     ABY /= ABLen;
 
-    // scan the AABB of our line segment, drawing pixels for the line, as is appropriate
+    // The pixels a line touches are the ones less than 2 pixels from it, which make a capsule around it. In each row
+    // those pixels are one span, since the capsule is convex, and it is the hull of the spans of the pieces making up
+    // the capsule: the band of points within 2 of the line which project onto the segment, and the discs around the
+    // two ends. The span is widened by a pixel on each side so that rounding can't leave out a pixel the per pixel
+    // distance below counts as touched.
+    const double dirX = double(x2 - x1) / double(ABLen);
+    const double dirY = double(y2 - y1) / double(ABLen);
+
+    const __m128 x1Vector = _mm_set1_ps(float(x1));
+    const __m128 y1Vector = _mm_set1_ps(float(y1));
+    const __m128 ABXVector = _mm_set1_ps(ABX);
+    const __m128 ABYVector = _mm_set1_ps(ABY);
+    const __m128 ABLenVector = _mm_set1_ps(ABLen);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 lutScale = _mm_set1_ps(float(c_coverageLUTScale));
+    const __m128 lutLast = _mm_set1_ps(float(c_coverageLUTSize - 1));
+    const __m128 laneOffsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    const CoverageLUTEntry* coverageLUT = GetCoverageLUT();
+
     for (int iy = startY; iy <= endY; ++iy)
     {
-        for (int ix = startX; ix <= endX; ++ix)
+        const double rowY = double(iy - y1);
+
+        double left = -HUGE_VAL, right = HUGE_VAL;
+        IntersectLinear(dirX, rowY * dirY, 0.0, double(ABLen), left, right);
+        IntersectLinear(dirY, -rowY * dirX, -2.0, 2.0, left, right);
+
+        const int endPointX[2] = { x1, x2 };
+        const int endPointY[2] = { y1, y2 };
+        for (int endPoint = 0; endPoint < 2; ++endPoint)
         {
-            RGBA& pixel = m_pixels[iy * m_width + ix];
-
-            // project this current pixel onto the line segment to get the closest point on the line segment to the point
-            float ACX = float(ix - x1);
-            float ACY = float(iy - y1);
-            float lineSegmentT = ACX * ABX + ACY * ABY;
-            lineSegmentT = std::min(lineSegmentT, ABLen);
-            lineSegmentT = std::max(lineSegmentT, 0.0f);
-            float closestX = float(x1) + lineSegmentT * ABX;
-            float closestY = float(y1) + lineSegmentT * ABY;
-
-            // calculate the distance from this pixel to the closest point on the line segment
-            float distanceX = float(ix) - closestX;
-            float distanceY = float(iy) - closestY;
-            float distance = (float)sqrt(distanceX * distanceX + distanceY * distanceY);
-
-            // use the distance to figure out how transparent the pixel should be, and apply the color to the pixel
-            float alpha = SmoothStep(distance, 2.0f, 0.0f);
-
-            if (alpha > 0.0f)
+            double offsetY = double(iy - endPointY[endPoint]);
+            double halfWidthSquared = 4.0 - offsetY * offsetY;
+            if (halfWidthSquared <= 0.0)
+                continue;
+
+            double halfWidth = sqrt(halfWidthSquared);
+            double discLeft = double(endPointX[endPoint] - x1) - halfWidth;
+            double discRight = double(endPointX[endPoint] - x1) + halfWidth;
+            if (left > right)
+            {
+                left = discLeft;
+                right = discRight;
+            }
+            else
             {
-                pixel = AlphaBlend(pixel, color, alpha);
+                left = std::min(left, discLeft);
+                right = std::max(right, discRight);
             }
         }
+        if (left > right)
+            continue;
+
+        const int spanStart = std::max(startX, int(floor(left)) + x1 - 1);
+        const int spanEnd = std::min(endX, int(ceil(right)) + x1 + 1);
+
+        // Four pixels at a time: project them onto the segment to get the closest points on it, and look up the
+        // coverage of their squared distances from those. Lanes past the end of the span are worked out and ignored.
+        const __m128 ACY = _mm_sub_ps(_mm_set1_ps(float(iy)), y1Vector);
+        const __m128 ACYTimesABY = _mm_mul_ps(ACY, ABYVector);
+        const __m128 pixelY = _mm_set1_ps(float(iy));
+        const __m128 spanEndVector = _mm_set1_ps(float(spanEnd));
+        for (int ix = spanStart; ix <= spanEnd; ix += 4)
+        {
+            __m128 pixelX = _mm_add_ps(_mm_set1_ps(float(ix)), laneOffsets);
+
+            __m128 ACX = _mm_sub_ps(pixelX, x1Vector);
+            __m128 lineSegmentT = _mm_add_ps(_mm_mul_ps(ACX, ABXVector), ACYTimesABY);
+            lineSegmentT = _mm_max_ps(_mm_min_ps(lineSegmentT, ABLenVector), zero);
+            __m128 closestX = _mm_add_ps(x1Vector, _mm_mul_ps(lineSegmentT, ABXVector));
+            __m128 closestY = _mm_add_ps(y1Vector, _mm_mul_ps(lineSegmentT, ABYVector));
+
+            __m128 distanceX = _mm_sub_ps(pixelX, closestX);
+            __m128 distanceY = _mm_sub_ps(pixelY, closestY);
+            __m128 distanceSquared = _mm_add_ps(_mm_mul_ps(distanceX, distanceX), _mm_mul_ps(distanceY, distanceY));
+
+            // interpolated from the entry below, clamping to the last one (which is 0, and stays 0) for anything
+            // further than 2 pixels away or past the end of the span
+            __m128 lutPosition = _mm_min_ps(_mm_mul_ps(distanceSquared, lutScale), lutLast);
+            lutPosition = _mm_max_ps(lutPosition, _mm_and_ps(_mm_cmpgt_ps(pixelX, spanEndVector), lutLast));
+            __m128i lutIndex = _mm_cvttps_epi32(lutPosition);
+            __m128 lutFraction = _mm_sub_ps(lutPosition, _mm_cvtepi32_ps(lutIndex));
+            int indices[4];
+            _mm_storeu_si128((__m128i*)indices, lutIndex);
+
+            // each entry's weight and slope are loaded together, and then gathered into a vector of each
+            __m128 entries01 = _mm_loadh_pi(_mm_loadl_pi(zero, (const __m64*)&coverageLUT[indices[0]]), (const __m64*)&coverageLUT[indices[1]]);
+            __m128 entries23 = _mm_loadh_pi(_mm_loadl_pi(zero, (const __m64*)&coverageLUT[indices[2]]), (const __m64*)&coverageLUT[indices[3]]);
+            __m128 lutWeight = _mm_shuffle_ps(entries01, entries23, _MM_SHUFFLE(2, 0, 2, 0));
+            __m128 lutSlope = _mm_shuffle_ps(entries01, entries23, _MM_SHUFFLE(3, 1, 3, 1));
+            __m128 weight = _mm_add_ps(_mm_add_ps(lutWeight, _mm_mul_ps(lutSlope, lutFraction)), half);
+
+            int weights[4];
+            _mm_storeu_si128((__m128i*)weights, _mm_cvttps_epi32(weight));
+
+            if (weights[0] | weights[1] | weights[2] | weights[3])
+                lambda(iy, ix, std::min(4, spanEnd - ix + 1), weights);
+        }
     }
 }
 
-void SImageData::Save(const char* fileName)
+// The pixels [m_x1, m_x2] x [m_y1, m_y2] of an image, or of a tile of one, in image coordinates. Pixel (x, y) is at
+// m_pixels[(y - m_y1) * m_stride + x - m_x1].
+struct PixelRect
 {
-    stbi_write_png(fileName, int(m_width), int(m_height), 4, m_pixels.data(), int(m_width * 4));
+    RGBA* m_pixels;
+    size_t m_stride;
+    int m_x1, m_y1, m_x2, m_y2;
+
+    RGBA* At(int x, int y) const
+    {
+        return &m_pixels[size_t(y - m_y1) * m_stride + size_t(x - m_x1)];
+    }
+};
+
+static void FillRect(const PixelRect& rect, const RGBA& color)
+{
+    for (int y = rect.m_y1; y <= rect.m_y2; ++y)
+        std::fill(rect.At(rect.m_x1, y), rect.At(rect.m_x2, y) + 1, color);
 }
 
-void SImageData::AppendHorizontal(const SImageData& image_, bool allowResize)
+// the part of [x1, x2) x [y1, y2) in rect, as SImageData::Box
+static void BoxInRect(const PixelRect& rect, int x1, int x2, int y1, int y2, const RGBA& color)
 {
-    // if this image is empty, just copy the other image
-    if (m_width == 0 && m_height == 0)
+    x1 = std::max(x1, rect.m_x1);
+    x2 = std::min(x2, rect.m_x2 + 1);
+    y1 = std::max(y1, rect.m_y1);
+    y2 = std::min(y2, rect.m_y2 + 1);
+    for (int y = y1; y < y2; ++y)
     {
-        *this = image_;
-        return;
+        if (x1 < x2)
+            std::fill(rect.At(x1, y), rect.At(x1, y) + (x2 - x1), color);
     }
+}
 
-    // must be same height
-    SImageData image = image_;
-    if (image.m_height != m_height)
+static void DrawLineInRect(const PixelRect& rect, int x1, int y1, int x2, int y2, const RGBA& color)
+{
+    ForEachLineCoverage(x1, y1, x2, y2, rect.m_x1, rect.m_y1, rect.m_x2, rect.m_y2,
+        [&] (int iy, int ix, int count, const int weights[4])
+        {
+            BlendPixels4(rect.At(ix, iy), count, rect.m_x2 - ix + 1, color, weights);
+        }
+    );
+}
+
+// The lines of a polyline given by segments (segment i joining point i to point i + 1) drawn as one shape in rect.
+// coverage gathers the biggest coverage any of the segments gives each pixel, which is the coverage of the nearest
+// segment, and the pixels are then blended once each, so the joints between segments are no darker than the rest
+// of the line.
+static void DrawPolylineInRect(const PixelRect& rect, const int* xs, const int* ys, const uint32_t* segments, size_t numSegments,
+    const RGBA& color, std::vector<uint16_t>& coverage)
+{
+    const int width = rect.m_x2 - rect.m_x1 + 1;
+    const int height = rect.m_y2 - rect.m_y1 + 1;
+    coverage.assign(size_t(width * height), 0);
+
+    for (size_t index = 0; index < numSegments; ++index)
+    {
+        size_t segment = segments[index];
+        ForEachLineCoverage(xs[segment], ys[segment], xs[segment + 1], ys[segment + 1], rect.m_x1, rect.m_y1, rect.m_x2, rect.m_y2,
+            [&] (int iy, int ix, int count, const int weights[4])
+            {
+                uint16_t* pixelCoverage = &coverage[(iy - rect.m_y1) * width + ix - rect.m_x1];
+                for (int lane = 0; lane < count; ++lane)
+                    pixelCoverage[lane] = std::max(pixelCoverage[lane], uint16_t(weights[lane]));
+            }
+        );
+    }
+
+    for (int iy = rect.m_y1; iy <= rect.m_y2; ++iy)
     {
-        if (!allowResize)
+        const uint16_t* rowCoverage = &coverage[(iy - rect.m_y1) * width];
+        for (int ix = rect.m_x1; ix <= rect.m_x2; ix += 4)
         {
-            printf("AppendHorizontal() image height mismatch! %zu vs %zu.\n", image.m_height, m_height);
-            return;
+            int count = std::min(4, rect.m_x2 - ix + 1);
+            int weights[4] = { 0, 0, 0, 0 };
+            for (int lane = 0; lane < count; ++lane)
+                weights[lane] = rowCoverage[ix - rect.m_x1 + lane];
+
+            if (weights[0] | weights[1] | weights[2] | weights[3])
+                BlendPixels4(rect.At(ix, iy), count, count, color, weights);
         }
-        else if (m_height < image.m_height)
+    }
+}
+
+// Lines are drawn a c_tileSize square tile at a time, which keeps a polyline's coverage in the L1 cache however big
+// the image is, and lets STiledImageData run tiles in parallel. A segment can cover the tiles its bounds touch, padded
+// by the 2 pixel falloff. Zero length segments draw nothing, as with DrawLine.
+static const int c_tileSize = STiledImageData::c_tileSize;
+
+static bool GetSegmentTiles(int x1, int y1, int x2, int y2, int width, int height, int& tileX1, int& tileY1, int& tileX2, int& tileY2)
+{
+    int minX = std::max(std::min(x1, x2) - 2, 0);
+    int minY = std::max(std::min(y1, y2) - 2, 0);
+    int maxX = std::min(std::max(x1, x2) + 2, width - 1);
+    int maxY = std::min(std::max(y1, y2) + 2, height - 1);
+    if ((x1 == x2 && y1 == y2) || minX > maxX || minY > maxY)
+        return false;
+
+    tileX1 = minX / c_tileSize;
+    tileY1 = minY / c_tileSize;
+    tileX2 = maxX / c_tileSize;
+    tileY2 = maxY / c_tileSize;
+    return true;
+}
+
+void SImageData::DrawLine(int x1, int y1, int x2, int y2, const RGBA& color)
+{
+    PixelRect rect = { m_pixels.data(), m_width, 0, 0, int(m_width) - 1, int(m_height) - 1 };
+    DrawLineInRect(rect, x1, y1, x2, y2, color);
+}
+
+void SImageData::DrawPolyline(const int* xs, const int* ys, size_t n, const RGBA& color)
+{
+    if (n < 2 || m_width == 0 || m_height == 0)
+        return;
+
+    const int width = int(m_width);
+    const int height = int(m_height);
+    const int tilesX = (width + c_tileSize - 1) / c_tileSize;
+    const int tilesY = (height + c_tileSize - 1) / c_tileSize;
+
+    // each tile's list of segments, one after another in tileSegments, by counting them first
+    std::vector<size_t> tileStarts(size_t(tilesX * tilesY) + 1, 0);
+    auto forEachSegmentTile = [&] (const auto& callback)
+    {
+        for (size_t segment = 0; segment + 1 < n; ++segment)
         {
-            SImageData pad;
-            pad.Resize(m_width, image.m_height - m_height);
-            AppendVertical(pad);
+            int tileX1, tileY1, tileX2, tileY2;
+            if (!GetSegmentTiles(xs[segment], ys[segment], xs[segment + 1], ys[segment + 1], width, height, tileX1, tileY1, tileX2, tileY2))
+                continue;
+
+            for (int tileY = tileY1; tileY <= tileY2; ++tileY)
+            {
+                for (int tileX = tileX1; tileX <= tileX2; ++tileX)
+                    callback(segment, size_t(tileY * tilesX + tileX));
+            }
         }
-        else
+    };
+    forEachSegmentTile([&] (size_t /*segment*/, size_t tile) { tileStarts[tile + 1]++; });
+    for (size_t tile = 0; tile + 1 < tileStarts.size(); ++tile)
+        tileStarts[tile + 1] += tileStarts[tile];
+
+    std::vector<uint32_t> tileSegments(tileStarts.back());
+    std::vector<size_t> tileEnds(tileStarts.begin(), tileStarts.end() - 1);
+    forEachSegmentTile([&] (size_t segment, size_t tile) { tileSegments[tileEnds[tile]++] = uint32_t(segment); });
+
+    std::vector<uint16_t> coverage;
+    for (int tileY = 0; tileY < tilesY; ++tileY)
+    {
+        for (int tileX = 0; tileX < tilesX; ++tileX)
         {
-            SImageData pad;
-            pad.Resize(image.m_width, m_height - image.m_height);
-            image.AppendVertical(pad);
+            size_t tile = size_t(tileY * tilesX + tileX);
+            if (tileStarts[tile] == tileStarts[tile + 1])
+                continue;
+
+            PixelRect rect;
+            rect.m_x1 = tileX * c_tileSize;
+            rect.m_y1 = tileY * c_tileSize;
+            rect.m_x2 = std::min(rect.m_x1 + c_tileSize, width) - 1;
+            rect.m_y2 = std::min(rect.m_y1 + c_tileSize, height) - 1;
+            rect.m_pixels = &m_pixels[size_t(rect.m_y1) * m_width + size_t(rect.m_x1)];
+            rect.m_stride = m_width;
+            DrawPolylineInRect(rect, xs, ys, &tileSegments[tileStarts[tile]], tileStarts[tile + 1] - tileStarts[tile], color, coverage);
         }
+    }
+}
+
+void SImageData::Save(const char* fileName)
+{
+    stbi_write_png(fileName, int(m_width), int(m_height), 4, m_pixels.data(), int(m_width * 4));
+}
 
-        // TODO: remove! should be an assert
-        if (image.m_height != m_height)
+void SImageData::Extend(size_t width, size_t height, RGBA fill)
+{
+    width = std::max(width, m_width);
+    height = std::max(height, m_height);
+    if (width == m_width && height == m_height)
+        return;
+
+    // The rows move to their new stride from the bottom up, so each one only lands on rows which have already
+    // moved. New rows at the bottom are filled by the resize.
+    const size_t oldWidth = m_width;
+    const size_t oldHeight = m_height;
+    m_pixels.resize(width * height, fill);
+    if (width != oldWidth)
+    {
+        for (size_t y = oldHeight; y-- > 0;)
         {
-            printf("FAIL AppendHorizontal() image height mismatch! %zu vs %zu.\n", image.m_height, m_height);
-            return;
+            RGBA* row = &m_pixels[y * width];
+            memmove(row, &m_pixels[y * oldWidth], oldWidth * sizeof(RGBA));
+            std::fill(row + oldWidth, row + width, fill);
         }
     }
 
-    SImageData result;
-    result.Resize(m_width + image.m_width, m_height);
+    m_width = width;
+    m_height = height;
+}
+
+void SImageData::Blit(const SImageData& image, size_t x, size_t y)
+{
+    if (image.m_width == 0 || image.m_height == 0)
+        return;
 
-    const RGBA* sourceLeft = m_pixels.data();
-    const RGBA* sourceRight = image.m_pixels.data();
+    const RGBA* source = image.m_pixels.data();
+    RGBA* dest = &m_pixels[y * m_width + x];
+    for (size_t row = 0; row < image.m_height; ++row)
+    {
+        memcpy(dest, source, image.m_width * sizeof(RGBA));
+        source += image.m_width;
+        dest += m_width;
+    }
+}
+
+void SImageData::Compose(const SImagePlacement* placements, size_t count, RGBA fill)
+{
+    size_t width = 0;
+    size_t height = 0;
+    for (size_t index = 0; index < count; ++index)
+    {
+        width = std::max(width, placements[index].m_x + placements[index].m_image->m_width);
+        height = std::max(height, placements[index].m_y + placements[index].m_image->m_height);
+    }
+
+    m_width = width;
+    m_height = height;
+    m_pixels.assign(width * height, fill);
+    for (size_t index = 0; index < count; ++index)
+        Blit(*placements[index].m_image, placements[index].m_x, placements[index].m_y);
+}
+
+void SImageData::ComposeGrid(const SImageData* const* images, size_t count, size_t numColumns, size_t padding, RGBA fill)
+{
+    numColumns = std::max<size_t>(std::min(numColumns, count), 1);
+    const size_t numRows = (count + numColumns - 1) / numColumns;
+
+    std::vector<size_t> columnXs(numColumns + 1, 0);
+    std::vector<size_t> rowYs(numRows + 1, 0);
+    for (size_t index = 0; index < count; ++index)
+    {
+        columnXs[index % numColumns + 1] = std::max(columnXs[index % numColumns + 1], images[index]->m_width + padding);
+        rowYs[index / numColumns + 1] = std::max(rowYs[index / numColumns + 1], images[index]->m_height + padding);
+    }
+    for (size_t column = 0; column < numColumns; ++column)
+        columnXs[column + 1] += columnXs[column];
+    for (size_t row = 0; row < numRows; ++row)
+        rowYs[row + 1] += rowYs[row];
 
-    size_t strideLeft = m_width;
-    size_t strideRight = image.m_width;
+    std::vector<SImagePlacement> placements(count);
+    for (size_t index = 0; index < count; ++index)
+        placements[index] = SImagePlacement{ images[index], columnXs[index % numColumns], rowYs[index / numColumns] };
+    Compose(placements.data(), count, fill);
+}
 
-    RGBA* dest = result.m_pixels.data();
+void SImageData::AppendHorizontal(const SImageData& image, bool allowResize)
+{
+    // if this image is empty, just copy the other image
+    if (m_width == 0 && m_height == 0)
+    {
+        *this = image;
+        return;
+    }
 
-    for (size_t y = 0; y < m_height; ++y)
+    // must be same height
+    if (image.m_height != m_height && !allowResize)
     {
-        memcpy(dest, sourceLeft, strideLeft * 4);
-        dest += strideLeft;
-        sourceLeft += strideLeft;
+        printf("AppendHorizontal() image height mismatch! %zu vs %zu.\n", image.m_height, m_height);
+        return;
+    }
 
-        memcpy(dest, sourceRight, strideRight * 4);
-        dest += strideRight;
-        sourceRight += strideRight;
+    // the image is about to grow, so appending it to itself needs a copy of it first
+    if (&image == this)
+    {
+        SImageData copy = image;
+        AppendHorizontal(copy, allowResize);
+        return;
     }
-    
-    *this = result;
+
+    const size_t x = m_width;
+    Extend(m_width + image.m_width, image.m_height);
+    Blit(image, x, 0);
 }
 
-void SImageData::AppendVertical(const SImageData& image_, bool allowResize)
+void SImageData::AppendHorizontal(SImageData&& image, bool allowResize)
+{
+    if (m_width == 0 && m_height == 0)
+        *this = std::move(image);
+    else
+        AppendHorizontal(static_cast<const SImageData&>(image), allowResize);
+}
+
+void SImageData::AppendVertical(const SImageData& image, bool allowResize)
 {
     // if this image is empty, just copy the other image
     if (m_width == 0 && m_height == 0)
     {
-        *this = image_;
+        *this = image;
         return;
     }
 
     // must be same width
-    SImageData image = image_;
-    if (image.m_width != m_width)
+    if (image.m_width != m_width && !allowResize)
     {
-        if (!allowResize)
-        {
-            printf("AppendVertical() image width mismatch! %zu vs %zu.\n", image.m_width, m_width);
-            return;
-        }
-        else if (m_width < image.m_width)
-        {
-            SImageData pad;
-            pad.Resize(image.m_width - m_width, m_height);
-            AppendHorizontal(pad);
-        }
-        else
+        printf("AppendVertical() image width mismatch! %zu vs %zu.\n", image.m_width, m_width);
+        return;
+    }
+
+    // the image is about to grow, so appending it to itself needs a copy of it first
+    if (&image == this)
+    {
+        SImageData copy = image;
+        AppendVertical(copy, allowResize);
+        return;
+    }
+
+    const size_t y = m_height;
+    Extend(image.m_width, m_height + image.m_height);
+    Blit(image, 0, y);
+}
+
+void SImageData::AppendVertical(SImageData&& image, bool allowResize)
+{
+    if (m_width == 0 && m_height == 0)
+        *this = std::move(image);
+    else
+        AppendVertical(static_cast<const SImageData&>(image), allowResize);
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+
+void STiledImageData::Resize(size_t width, size_t height, RGBA fill)
+{
+    m_width = width;
+    m_height = height;
+    m_tilesX = (width + c_tileSize - 1) / c_tileSize;
+    m_tilesY = (height + c_tileSize - 1) / c_tileSize;
+    m_tiles.assign(m_tilesX * m_tilesY * c_tileSize * c_tileSize, fill);
+    m_commands.clear();
+    m_pointXs.clear();
+    m_pointYs.clear();
+    m_tileEntries.assign(m_tilesX * m_tilesY, std::vector<TileEntry>());
+}
+
+void STiledImageData::AddCommand(const Command& command, int tileX1, int tileY1, int tileX2, int tileY2)
+{
+    uint32_t commandIndex = uint32_t(m_commands.size());
+    m_commands.push_back(command);
+    for (int tileY = tileY1; tileY <= tileY2; ++tileY)
+    {
+        for (int tileX = tileX1; tileX <= tileX2; ++tileX)
+            m_tileEntries[size_t(tileY) * m_tilesX + size_t(tileX)].push_back(TileEntry{ commandIndex, 0 });
+    }
+}
+
+void STiledImageData::Fill(const RGBA& color)
+{
+    if (m_tileEntries.empty())
+        return;
+
+    Command command = { CommandType::Fill, color, { 0, 0, 0, 0 }, 0 };
+    AddCommand(command, 0, 0, int(m_tilesX) - 1, int(m_tilesY) - 1);
+}
+
+void STiledImageData::Box(size_t x1, size_t x2, size_t y1, size_t y2, const RGBA& color)
+{
+    x2 = std::min(x2, m_width);
+    y2 = std::min(y2, m_height);
+    if (x1 >= x2 || y1 >= y2)
+        return;
+
+    Command command = { CommandType::Box, color, { int(x1), int(x2), int(y1), int(y2) }, 0 };
+    AddCommand(command, int(x1) / c_tileSize, int(y1) / c_tileSize, int(x2 - 1) / c_tileSize, int(y2 - 1) / c_tileSize);
+}
+
+void STiledImageData::DrawLine(int x1, int y1, int x2, int y2, const RGBA& color)
+{
+    int tileX1, tileY1, tileX2, tileY2;
+    if (!GetSegmentTiles(x1, y1, x2, y2, int(m_width), int(m_height), tileX1, tileY1, tileX2, tileY2))
+        return;
+
+    Command command = { CommandType::Line, color, { x1, y1, x2, y2 }, 0 };
+    AddCommand(command, tileX1, tileY1, tileX2, tileY2);
+}
+
+void STiledImageData::DrawPolyline(const int* xs, const int* ys, size_t n, const RGBA& color)
+{
+    if (n < 2 || m_tileEntries.empty())
+        return;
+
+    uint32_t commandIndex = uint32_t(m_commands.size());
+    Command command = { CommandType::Polyline, color, { 0, 0, 0, 0 }, m_pointXs.size() };
+    m_commands.push_back(command);
+    m_pointXs.insert(m_pointXs.end(), xs, xs + n);
+    m_pointYs.insert(m_pointYs.end(), ys, ys + n);
+
+    for (size_t segment = 0; segment + 1 < n; ++segment)
+    {
+        int tileX1, tileY1, tileX2, tileY2;
+        if (!GetSegmentTiles(xs[segment], ys[segment], xs[segment + 1], ys[segment + 1], int(m_width), int(m_height), tileX1, tileY1, tileX2, tileY2))
+            continue;
+
+        for (int tileY = tileY1; tileY <= tileY2; ++tileY)
         {
-            SImageData pad;
-            pad.Resize(m_width - image.m_width, image.m_height);
-            image.AppendHorizontal(pad);
+            for (int tileX = tileX1; tileX <= tileX2; ++tileX)
+                m_tileEntries[size_t(tileY) * m_tilesX + size_t(tileX)].push_back(TileEntry{ commandIndex, uint32_t(segment) });
         }
+    }
+}
 
-        // TODO: remove! should be an assert
-        if (image.m_width != m_width)
+void STiledImageData::Execute(size_t numThreads)
+{
+    if (m_commands.empty())
+        return;
+
+    ParallelFor(m_tileEntries.size(), GetNumThreads(numThreads),
+        [&] (size_t tile)
         {
-            printf("FAIL AppendHorizontal() image height mismatch! %zu vs %zu.\n", image.m_height, m_height);
-            return;
+            std::vector<TileEntry>& entries = m_tileEntries[tile];
+            if (entries.empty())
+                return;
+
+            PixelRect rect;
+            rect.m_x1 = int(tile % m_tilesX) * c_tileSize;
+            rect.m_y1 = int(tile / m_tilesX) * c_tileSize;
+            rect.m_x2 = std::min(rect.m_x1 + c_tileSize, int(m_width)) - 1;
+            rect.m_y2 = std::min(rect.m_y1 + c_tileSize, int(m_height)) - 1;
+            rect.m_pixels = &m_tiles[tile * c_tileSize * c_tileSize];
+            rect.m_stride = c_tileSize;
+
+            std::vector<uint16_t> coverage;
+            std::vector<uint32_t> segments;
+            for (size_t index = 0; index < entries.size();)
+            {
+                const Command& command = m_commands[entries[index].m_command];
+                const int* coords = command.m_coords;
+                switch (command.m_type)
+                {
+                    case CommandType::Fill: FillRect(rect, command.m_color); break;
+                    case CommandType::Box: BoxInRect(rect, coords[0], coords[1], coords[2], coords[3], command.m_color); break;
+                    case CommandType::Line: DrawLineInRect(rect, coords[0], coords[1], coords[2], coords[3], command.m_color); break;
+                    case CommandType::Polyline:
+                    {
+                        // all of the polyline's segments in this tile, which were added one after another
+                        segments.clear();
+                        for (; index < entries.size() && &m_commands[entries[index].m_command] == &command; ++index)
+                            segments.push_back(entries[index].m_segment);
+
+                        DrawPolylineInRect(rect, &m_pointXs[command.m_firstPoint], &m_pointYs[command.m_firstPoint], segments.data(),
+                            segments.size(), command.m_color, coverage);
+                        continue;
+                    }
+                }
+                ++index;
+            }
+            entries.clear();
         }
+    );
+
+    m_commands.clear();
+    m_pointXs.clear();
+    m_pointYs.clear();
+}
+
+void STiledImageData::Flatten(SImageData& image, size_t numThreads)
+{
+    Execute(numThreads);
+
+    image.m_width = m_width;
+    image.m_height = m_height;
+    image.m_pixels.resize(m_width * m_height);
+    for (size_t tile = 0; tile < m_tilesX * m_tilesY; ++tile)
+    {
+        size_t x1 = (tile % m_tilesX) * c_tileSize;
+        size_t y1 = (tile / m_tilesX) * c_tileSize;
+        size_t width = std::min<size_t>(c_tileSize, m_width - x1);
+        size_t height = std::min<size_t>(c_tileSize, m_height - y1);
+        const RGBA* source = &m_tiles[tile * c_tileSize * c_tileSize];
+        for (size_t y = 0; y < height; ++y)
+            memcpy(&image.m_pixels[(y1 + y) * m_width + x1], &source[y * c_tileSize], width * sizeof(RGBA));
     }
+}
 
-    SImageData result;
-    result.Resize(m_width, m_height + image.m_height);
-    memcpy(result.m_pixels.data(), m_pixels.data(), m_width * m_height * 4);
-    memcpy(&result.m_pixels[m_width * m_height], image.m_pixels.data(), image.m_width * image.m_height * 4);
-    *this = result;
-}
\ No newline at end of file
+void STiledImageData::Save(const char* fileName)
+{
+    SImageData image;
+    Flatten(image);
+    image.Save(fileName);
+}
@@ -11,6 +11,8 @@ struct RGBA
     uint8 R, G, B, A;
 };
 
+struct SImagePlacement;
+
 struct SImageData
 {
     size_t m_width = 0;
@@ -40,8 +42,97 @@ struct SImageData
 
     void DrawLine(int x1, int y1, int x2, int y2, const RGBA& color);
 
+    // Draws the n - 1 lines joining (xs[i], ys[i]) to (xs[i + 1], ys[i + 1]) as one shape, each pixel covered as
+    // much as the nearest line covers it and blended once, so the joints aren't drawn twice.
+    void DrawPolyline(const int* xs, const int* ys, size_t n, const RGBA& color);
+
     void Save(const char* fileName);
 
+    // Grows the image to at least width x height in place, keeping its pixels at the top left and filling the rest
+    void Extend(size_t width, size_t height, RGBA fill = RGBA{ 255, 255, 255, 255 });
+
+    // Copies image into this one with its top left at (x, y), a row at a time. It must fit.
+    void Blit(const SImageData& image, size_t x, size_t y);
+
+    // Makes this image just big enough to hold every placed image, and copies each one into place. The canvas is
+    // allocated once, so composing n images copies each of them once rather than everything so far n times.
+    void Compose(const SImagePlacement* placements, size_t count, RGBA fill = RGBA{ 255, 255, 255, 255 });
+
+    // A contact sheet of the images, in rows of numColumns. Each column is as wide as its widest image and each row
+    // as tall as its tallest, with padding pixels between them.
+    void ComposeGrid(const SImageData* const* images, size_t count, size_t numColumns, size_t padding = 0, RGBA fill = RGBA{ 255, 255, 255, 255 });
+
+    // These grow this image in place and copy the image after it. When allowResize is set, the smaller of the two is
+    // padded with white to match the other. Appending to an empty image takes the image, moving it when it can.
     void AppendHorizontal(const SImageData& image, bool allowResize = false);
+    void AppendHorizontal(SImageData&& image, bool allowResize = false);
     void AppendVertical(const SImageData& image, bool allowResize = false);
+    void AppendVertical(SImageData&& image, bool allowResize = false);
+};
+
+// An image for SImageData::Compose, and where its top left goes
+struct SImagePlacement
+{
+    const SImageData* m_image;
+    size_t m_x;
+    size_t m_y;
+};
+
+// An image kept as c_tileSize square tiles, for big images. Drawing records commands, sorting each into the tiles
+// it touches, and Execute() runs each tile's commands in the order they were given, with the tiles spread across
+// threads. Every command changes each pixel according to that pixel alone, so the result is exactly what SImageData
+// would draw. The pixels are only laid out in rows by Flatten() and Save(), which execute anything still pending.
+struct STiledImageData
+{
+    static const int c_tileSize = 64;
+
+    size_t m_width = 0;
+    size_t m_height = 0;
+
+    void Resize(size_t width, size_t height, RGBA fill = RGBA{ 255, 255, 255, 255 });
+
+    void Fill(const RGBA& color);
+    void Box(size_t x1, size_t x2, size_t y1, size_t y2, const RGBA& color);
+    void DrawLine(int x1, int y1, int x2, int y2, const RGBA& color);
+    void DrawPolyline(const int* xs, const int* ys, size_t n, const RGBA& color);
+
+    // numThreads of 0 uses every hardware thread
+    void Execute(size_t numThreads = 0);
+    void Flatten(SImageData& image, size_t numThreads = 0);
+    void Save(const char* fileName);
+
+private:
+    enum class CommandType
+    {
+        Fill,
+        Box,
+        Line,
+        Polyline
+    };
+
+    // m_coords are the box or line's coordinates, as they were given. A polyline's points are m_points[m_firstPoint]
+    // onwards, and each tile it touches gets an entry for every segment which touches it.
+    struct Command
+    {
+        CommandType m_type;
+        RGBA m_color;
+        int m_coords[4];
+        size_t m_firstPoint;
+    };
+
+    struct TileEntry
+    {
+        uint32_t m_command;
+        uint32_t m_segment;
+    };
+
+    void AddCommand(const Command& command, int tileX1, int tileY1, int tileX2, int tileY2);
+
+    size_t m_tilesX = 0;
+    size_t m_tilesY = 0;
+    std::vector<RGBA> m_tiles;
+    std::vector<Command> m_commands;
+    std::vector<int> m_pointXs;
+    std::vector<int> m_pointYs;
+    std::vector<std::vector<TileEntry>> m_tileEntries;
 };
@@ -0,0 +1,376 @@
+#pragma once
+
+#include <algorithm>
+#include <emmintrin.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// A mergeable sketch of a stream of non negative values which answers quantile queries to within a relative
+// error, in the spirit of DDSketch (Masson, Rim and Lee, "DDSketch: A Fast and Fully-Mergeable Quantile Sketch
+// with Relative-Error Guarantees"). Values are counted in buckets whose width is proportional to the values in
+// them, and two sketches merge by adding their counts, so merging gives the same sketch as adding every value
+// to one of them.
+//
+// Instead of taking a log, a value's bucket is read straight from the bits of the double: its exponent and the
+// top c_subBucketBits bits of its mantissa. Each power of two is split into 2^c_subBucketBits equal buckets, so
+// every value is within 1 / 2^(c_subBucketBits + 1) of its bucket's middle, which is what a quantile reports.
+// Values at or below c_minValue (including 0) count as 0. At most c_maxBuckets buckets are kept, and when the
+// values span more than that the lowest ones are folded together, losing accuracy on the low quantiles first.
+class QuantileSketch
+{
+public:
+    static const int c_subBucketBits = 5;
+    static const int32_t c_maxBuckets = 32 << c_subBucketBits;
+    static constexpr double c_minValue = 1.0 / 4294967296.0;
+
+    void Clear()
+    {
+        m_count = 0;
+        m_zeroCount = 0;
+        m_firstBucket = 0;
+        m_counts.clear();
+    }
+
+    uint64_t GetCount() const
+    {
+        return m_count;
+    }
+
+    void Add(double value)
+    {
+        m_count++;
+
+        // negatives and NaNs included
+        if (!(value > c_minValue))
+        {
+            m_zeroCount++;
+            return;
+        }
+
+        int32_t bucket = BucketIndex(value);
+        if (bucket < m_firstBucket || bucket >= m_firstBucket + int32_t(m_counts.size()))
+            Grow(bucket, bucket);
+        m_counts[std::max(bucket, m_firstBucket) - m_firstBucket]++;
+    }
+
+    void Merge(const QuantileSketch& other)
+    {
+        m_count += other.m_count;
+        m_zeroCount += other.m_zeroCount;
+        if (other.m_counts.empty())
+            return;
+
+        const int32_t otherEnd = other.m_firstBucket + int32_t(other.m_counts.size());
+        Grow(other.m_firstBucket, otherEnd - 1);
+        for (int32_t bucket = other.m_firstBucket; bucket < otherEnd; ++bucket)
+            m_counts[std::max(bucket, m_firstBucket) - m_firstBucket] += other.m_counts[bucket - other.m_firstBucket];
+    }
+
+    // The value at quantile q in [0, 1], taking the value of rank q * (count - 1) like DDSketch does
+    double GetQuantile(double q) const
+    {
+        if (m_count == 0)
+            return 0.0;
+
+        double rank = std::min(std::max(q, 0.0), 1.0) * double(m_count - 1);
+        uint64_t seen = m_zeroCount;
+        if (double(seen) > rank)
+            return 0.0;
+
+        for (size_t index = 0; index < m_counts.size(); ++index)
+        {
+            seen += m_counts[index];
+            if (double(seen) > rank)
+                return BucketValue(m_firstBucket + int32_t(index));
+        }
+        return BucketValue(m_firstBucket + int32_t(m_counts.size()) - 1);
+    }
+
+    // to and from a CheckpointWriter / CheckpointReader
+    template <typename WRITER>
+    void Write(WRITER& writer) const
+    {
+        writer.Write(m_count);
+        writer.Write(m_zeroCount);
+        writer.Write(m_firstBucket);
+        writer.Write(m_counts);
+    }
+
+    template <typename READER>
+    bool Read(READER& reader)
+    {
+        return reader.Read(m_count) && reader.Read(m_zeroCount) && reader.Read(m_firstBucket) && reader.Read(m_counts) &&
+            int64_t(m_counts.size()) <= int64_t(c_maxBuckets);
+    }
+
+private:
+    static int32_t BucketIndex(double value)
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return int32_t(bits >> (52 - c_subBucketBits));
+    }
+
+    // the middle of a bucket
+    static double BucketValue(int32_t bucket)
+    {
+        uint64_t lowBits = uint64_t(bucket) << (52 - c_subBucketBits);
+        uint64_t highBits = uint64_t(bucket + 1) << (52 - c_subBucketBits);
+        double low, high;
+        memcpy(&low, &lowBits, sizeof(low));
+        memcpy(&high, &highBits, sizeof(high));
+        return (low + high) * 0.5;
+    }
+
+    // Makes the kept buckets cover low to high. A side that grows gets some room to spare, so a sketch which is
+    // still finding its range doesn't reallocate for every new bucket.
+    void Grow(int32_t low, int32_t high)
+    {
+        const int32_t c_spare = 1 << c_subBucketBits;
+
+        int32_t oldEnd = m_firstBucket + int32_t(m_counts.size());
+        int32_t newFirst = low;
+        int32_t newEnd = high + 1;
+        if (!m_counts.empty())
+        {
+            newFirst = (low < m_firstBucket) ? low - c_spare : m_firstBucket;
+            newEnd = (high >= oldEnd) ? high + 1 + c_spare : oldEnd;
+        }
+        if (newEnd - newFirst > c_maxBuckets)
+            newFirst = newEnd - c_maxBuckets;
+        if (newFirst == m_firstBucket && newEnd == oldEnd)
+            return;
+
+        std::vector<uint32_t> counts(size_t(newEnd - newFirst), 0);
+        for (int32_t bucket = m_firstBucket; bucket < oldEnd; ++bucket)
+            counts[std::max(bucket, newFirst) - newFirst] += m_counts[bucket - m_firstBucket];
+        m_counts.swap(counts);
+        m_firstBucket = newFirst;
+    }
+
+    uint64_t m_count = 0;
+    uint64_t m_zeroCount = 0;
+    int32_t m_firstBucket = 0;
+    std::vector<uint32_t> m_counts;
+};
+
+// Per-bin running mean, sum of squared deviations from the mean (M2), min and max over a stream of spectra,
+// updated with Welford's algorithm. Accumulators of disjoint sets of spectra can be merged with the parallel
+// variance combine of Chan et al., so each thread can accumulate on its own.
+//
+// Add and Merge do two bins at a time with SSE2, doing the same operations in the same order as one bin at a
+// time would, so the results don't depend on the vectorization. Setting m_trackPercentiles before the first Add
+// also keeps a QuantileSketch per bin, for GetPercentile. That costs a bucket lookup per bin per spectrum and
+// a few KB per bin, so it is off unless asked for.
+struct SpectrumAccumulator
+{
+    size_t m_count = 0;
+    std::vector<double> m_mean;
+    std::vector<double> m_M2;
+    std::vector<double> m_min;
+    std::vector<double> m_max;
+
+    bool m_trackPercentiles = false;
+    std::vector<QuantileSketch> m_sketches;
+
+    // empties the accumulator, keeping whether it tracks percentiles
+    void Clear()
+    {
+        m_count = 0;
+        m_mean.clear();
+        m_M2.clear();
+        m_min.clear();
+        m_max.clear();
+        m_sketches.clear();
+    }
+
+    void Add(const std::vector<double>& values)
+    {
+        const size_t count = values.size();
+        if (m_count == 0)
+        {
+            m_mean.assign(count, 0.0);
+            m_M2.assign(count, 0.0);
+            m_min = values;
+            m_max = values;
+            if (m_trackPercentiles)
+                m_sketches.assign(count, QuantileSketch());
+        }
+
+        m_count++;
+        const double oneOverCount = 1.0 / double(m_count);
+
+        const double* in = values.data();
+        double* mean = m_mean.data();
+        double* M2 = m_M2.data();
+        double* min = m_min.data();
+        double* max = m_max.data();
+
+        const __m128d oneOverCountVector = _mm_set1_pd(oneOverCount);
+        size_t index = 0;
+        for (; index + 2 <= count; index += 2)
+        {
+            __m128d value = _mm_loadu_pd(&in[index]);
+            __m128d oldMean = _mm_loadu_pd(&mean[index]);
+            __m128d delta = _mm_sub_pd(value, oldMean);
+            __m128d newMean = _mm_add_pd(oldMean, _mm_mul_pd(delta, oneOverCountVector));
+            _mm_storeu_pd(&mean[index], newMean);
+            _mm_storeu_pd(&M2[index], _mm_add_pd(_mm_loadu_pd(&M2[index]), _mm_mul_pd(delta, _mm_sub_pd(value, newMean))));
+            _mm_storeu_pd(&min[index], _mm_min_pd(_mm_loadu_pd(&min[index]), value));
+            _mm_storeu_pd(&max[index], _mm_max_pd(_mm_loadu_pd(&max[index]), value));
+        }
+        for (; index < count; ++index)
+        {
+            double delta = in[index] - mean[index];
+            mean[index] += delta * oneOverCount;
+            M2[index] += delta * (in[index] - mean[index]);
+            min[index] = std::min(min[index], in[index]);
+            max[index] = std::max(max[index], in[index]);
+        }
+
+        if (!m_sketches.empty())
+        {
+            for (index = 0; index < count; ++index)
+                m_sketches[index].Add(in[index]);
+        }
+    }
+
+    void Merge(const SpectrumAccumulator& other)
+    {
+        if (other.m_count == 0)
+            return;
+
+        if (m_count == 0)
+        {
+            *this = other;
+            return;
+        }
+
+        const double countA = double(m_count);
+        const double countB = double(other.m_count);
+        const double countTotal = countA + countB;
+        const size_t count = m_mean.size();
+
+        const double* otherMean = other.m_mean.data();
+        const double* otherM2 = other.m_M2.data();
+        const double* otherMin = other.m_min.data();
+        const double* otherMax = other.m_max.data();
+        double* mean = m_mean.data();
+        double* M2 = m_M2.data();
+        double* min = m_min.data();
+        double* max = m_max.data();
+
+        const __m128d countAVector = _mm_set1_pd(countA);
+        const __m128d countBVector = _mm_set1_pd(countB);
+        const __m128d countTotalVector = _mm_set1_pd(countTotal);
+        size_t index = 0;
+        for (; index + 2 <= count; index += 2)
+        {
+            __m128d oldMean = _mm_loadu_pd(&mean[index]);
+            __m128d delta = _mm_sub_pd(_mm_loadu_pd(&otherMean[index]), oldMean);
+            _mm_storeu_pd(&mean[index], _mm_add_pd(oldMean, _mm_div_pd(_mm_mul_pd(delta, countBVector), countTotalVector)));
+            __m128d between = _mm_div_pd(_mm_mul_pd(_mm_mul_pd(_mm_mul_pd(delta, delta), countAVector), countBVector), countTotalVector);
+            _mm_storeu_pd(&M2[index], _mm_add_pd(_mm_loadu_pd(&M2[index]), _mm_add_pd(_mm_loadu_pd(&otherM2[index]), between)));
+            _mm_storeu_pd(&min[index], _mm_min_pd(_mm_loadu_pd(&min[index]), _mm_loadu_pd(&otherMin[index])));
+            _mm_storeu_pd(&max[index], _mm_max_pd(_mm_loadu_pd(&max[index]), _mm_loadu_pd(&otherMax[index])));
+        }
+        for (; index < count; ++index)
+        {
+            double delta = otherMean[index] - mean[index];
+            mean[index] += delta * countB / countTotal;
+            M2[index] += otherM2[index] + delta * delta * countA * countB / countTotal;
+            min[index] = std::min(min[index], otherMin[index]);
+            max[index] = std::max(max[index], otherMax[index]);
+        }
+
+        for (index = 0; index < m_sketches.size() && index < other.m_sketches.size(); ++index)
+            m_sketches[index].Merge(other.m_sketches[index]);
+
+        m_count += other.m_count;
+    }
+
+    // to and from a CheckpointWriter / CheckpointReader, exactly
+    template <typename WRITER>
+    void Write(WRITER& writer) const
+    {
+        writer.Write(uint64_t(m_count));
+        writer.Write(m_mean);
+        writer.Write(m_M2);
+        writer.Write(m_min);
+        writer.Write(m_max);
+        writer.Write(uint8_t(m_trackPercentiles));
+        writer.Write(uint64_t(m_sketches.size()));
+        for (const QuantileSketch& sketch : m_sketches)
+            sketch.Write(writer);
+    }
+
+    template <typename READER>
+    bool Read(READER& reader)
+    {
+        uint64_t count, numSketches;
+        uint8_t trackPercentiles;
+        if (!reader.Read(count) || !reader.Read(m_mean) || !reader.Read(m_M2) || !reader.Read(m_min) || !reader.Read(m_max) ||
+            !reader.Read(trackPercentiles) || !reader.Read(numSketches))
+            return false;
+
+        m_count = size_t(count);
+        m_trackPercentiles = (trackPercentiles != 0);
+        const size_t numBins = m_mean.size();
+        if (m_M2.size() != numBins || m_min.size() != numBins || m_max.size() != numBins || (numSketches != 0 && numSketches != numBins))
+            return false;
+
+        m_sketches.resize(size_t(numSketches));
+        for (QuantileSketch& sketch : m_sketches)
+        {
+            if (!sketch.Read(reader))
+                return false;
+        }
+        return true;
+    }
+
+    // population standard deviation of each bin
+    void GetStdDev(std::vector<double>& stdDev) const
+    {
+        stdDev.resize(m_mean.size());
+        for (size_t index = 0; index < m_mean.size(); ++index)
+            stdDev[index] = (m_count > 0) ? sqrt(m_M2[index] / double(m_count)) : 0.0;
+    }
+
+    // population variance of each bin
+    void GetVariance(std::vector<double>& variance) const
+    {
+        variance.resize(m_mean.size());
+        for (size_t index = 0; index < m_mean.size(); ++index)
+            variance[index] = (m_count > 0) ? m_M2[index] / double(m_count) : 0.0;
+    }
+
+    // The widest confidence interval of any bin's mean, as a fraction of that mean. The interval's half width is
+    // z standard errors, sqrt(M2 / (n - 1) / n), so z = 1.96 gives a 95% interval. A bin with a mean of 0 only
+    // counts if its interval isn't 0 too, and then it's infinitely wide.
+    double GetMaxRelativeHalfWidth(double z) const
+    {
+        if (m_count < 2)
+            return HUGE_VAL;
+
+        const double scale = z / sqrt(double(m_count - 1) * double(m_count));
+        double maxRelative = 0.0;
+        for (size_t index = 0; index < m_mean.size(); ++index)
+        {
+            double halfWidth = scale * sqrt(m_M2[index]);
+            double mean = fabs(m_mean[index]);
+            if (halfWidth > maxRelative * mean)
+                maxRelative = (mean > 0.0) ? halfWidth / mean : HUGE_VAL;
+        }
+        return maxRelative;
+    }
+
+    // The given percentile, in [0, 100], of each bin. Needs m_trackPercentiles.
+    void GetPercentile(double percentile, std::vector<double>& values) const
+    {
+        values.resize(m_sketches.size());
+        for (size_t index = 0; index < m_sketches.size(); ++index)
+            values[index] = m_sketches[index].GetQuantile(percentile / 100.0);
+    }
+};
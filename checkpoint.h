@@ -0,0 +1,272 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "accumulator.h"
+
+// Checkpoints let a long DoTest run pick up where it left off after a crash or preemption. A checkpoint holds
+// everything the run has accumulated after some number of whole chunks: the merged SpectrumAccumulator, the next
+// chunk to run, and the first test's values and DFT for the single test images. Since the total only ever merges
+// chunks in chunk order, a resumed run does exactly the same merges as an uninterrupted one and its results are
+// bit identical (with DETERMINISTIC() on, so the chunks themselves are the same).
+//
+// The file is native endian binary: the magic, the version, a CheckpointHeader which must match the run resuming
+// from it, the state, and an FNV-1a hash of everything before it. It is written to a temporary file which then
+// replaces the checkpoint, so an interruption mid write leaves the previous checkpoint intact.
+
+static const char c_checkpointMagic[8] = { 'D', 'F', 'T', 'C', 'K', 'P', 'T', 0 };
+static const uint32_t c_checkpointVersion = 1;
+
+// What a run has to have in common with the run that wrote a checkpoint to continue from it
+struct CheckpointHeader
+{
+    std::string m_testName;
+    std::string m_rngName;
+    uint64_t m_numTests = 0;
+    uint64_t m_numValues = 0;
+    uint64_t m_trialsPerChunk = 0;
+    uint64_t m_DFTBucketCount = 0;
+    uint64_t m_normalizeMode = 0;
+    bool m_trackPercentiles = false;
+};
+
+inline FILE* OpenFile(const char* fileName, const char* mode)
+{
+#ifdef _MSC_VER
+    FILE* file = nullptr;
+    fopen_s(&file, fileName, mode);
+    return file;
+#else
+    return fopen(fileName, mode);
+#endif
+}
+
+inline uint64_t HashFNV1a(const uint8_t* data, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t index = 0; index < size; ++index)
+    {
+        hash ^= data[index];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Builds a checkpoint in memory, so it goes to disk in one write
+class CheckpointWriter
+{
+public:
+    void Write(const void* data, size_t size)
+    {
+        const uint8_t* bytes = (const uint8_t*)data;
+        m_buffer.insert(m_buffer.end(), bytes, bytes + size);
+    }
+
+    template <typename T>
+    void Write(const T& value)
+    {
+        Write(&value, sizeof(value));
+    }
+
+    template <typename T>
+    void Write(const std::vector<T>& values)
+    {
+        Write(uint64_t(values.size()));
+        if (!values.empty())
+            Write(values.data(), values.size() * sizeof(T));
+    }
+
+    void Write(const std::string& value)
+    {
+        Write(uint64_t(value.size()));
+        Write(value.data(), value.size());
+    }
+
+    // writes the hash and then the buffer to fileName's temporary file, and moves that over fileName
+    bool Save(const char* fileName)
+    {
+        Write(HashFNV1a(m_buffer.data(), m_buffer.size()));
+
+        std::string tempFileName = std::string(fileName) + ".tmp";
+        FILE* file = OpenFile(tempFileName.c_str(), "wb");
+        if (!file)
+            return false;
+        bool written = fwrite(m_buffer.data(), 1, m_buffer.size(), file) == m_buffer.size();
+        written = (fflush(file) == 0) && written;
+        fclose(file);
+        if (!written)
+        {
+            remove(tempFileName.c_str());
+            return false;
+        }
+
+        // rename won't replace an existing file on Windows. A crash between the two leaves only the temporary
+        // file, which Load falls back to.
+        remove(fileName);
+        return rename(tempFileName.c_str(), fileName) == 0;
+    }
+
+private:
+    std::vector<uint8_t> m_buffer;
+};
+
+// Reads back what CheckpointWriter wrote, every Read failing once anything runs past the end of the file
+class CheckpointReader
+{
+public:
+    // loads fileName, or its temporary file if there is no fileName, and checks the hash
+    bool Load(const char* fileName)
+    {
+        if (!LoadFile(fileName) && !LoadFile((std::string(fileName) + ".tmp").c_str()))
+            return false;
+
+        uint64_t hash;
+        if (m_buffer.size() < sizeof(hash))
+            return false;
+        size_t size = m_buffer.size() - sizeof(hash);
+        memcpy(&hash, &m_buffer[size], sizeof(hash));
+        m_buffer.resize(size);
+        return hash == HashFNV1a(m_buffer.data(), size);
+    }
+
+    bool Read(void* data, size_t size)
+    {
+        if (size > m_buffer.size() - m_position)
+            return false;
+        if (size > 0)
+            memcpy(data, &m_buffer[m_position], size);
+        m_position += size;
+        return true;
+    }
+
+    template <typename T>
+    bool Read(T& value)
+    {
+        return Read(&value, sizeof(value));
+    }
+
+    template <typename T>
+    bool Read(std::vector<T>& values)
+    {
+        uint64_t size;
+        if (!Read(size) || size > (m_buffer.size() - m_position) / sizeof(T))
+            return false;
+        values.resize(size_t(size));
+        return Read(values.data(), values.size() * sizeof(T));
+    }
+
+    bool Read(std::string& value)
+    {
+        uint64_t size;
+        if (!Read(size) || size > m_buffer.size() - m_position)
+            return false;
+        value.assign((const char*)&m_buffer[m_position], size_t(size));
+        m_position += size_t(size);
+        return true;
+    }
+
+private:
+    bool LoadFile(const char* fileName)
+    {
+        FILE* file = OpenFile(fileName, "rb");
+        if (!file)
+            return false;
+
+        m_buffer.clear();
+        m_position = 0;
+        uint8_t block[64 * 1024];
+        size_t count;
+        while ((count = fread(block, 1, sizeof(block), file)) > 0)
+            m_buffer.insert(m_buffer.end(), block, block + count);
+        fclose(file);
+        return true;
+    }
+
+    std::vector<uint8_t> m_buffer;
+    size_t m_position = 0;
+};
+
+inline void WriteCheckpointHeader(CheckpointWriter& writer, const CheckpointHeader& header)
+{
+    writer.Write(c_checkpointMagic, sizeof(c_checkpointMagic));
+    writer.Write(c_checkpointVersion);
+    writer.Write(header.m_testName);
+    writer.Write(header.m_rngName);
+    writer.Write(header.m_numTests);
+    writer.Write(header.m_numValues);
+    writer.Write(header.m_trialsPerChunk);
+    writer.Write(header.m_DFTBucketCount);
+    writer.Write(header.m_normalizeMode);
+    writer.Write(uint8_t(header.m_trackPercentiles));
+}
+
+// whether the checkpoint's header is the one given
+inline bool ReadCheckpointHeader(CheckpointReader& reader, const CheckpointHeader& expected)
+{
+    char magic[sizeof(c_checkpointMagic)];
+    uint32_t version;
+    if (!reader.Read(magic, sizeof(magic)) || memcmp(magic, c_checkpointMagic, sizeof(magic)) != 0 ||
+        !reader.Read(version) || version != c_checkpointVersion)
+        return false;
+
+    CheckpointHeader header;
+    uint8_t trackPercentiles;
+    if (!reader.Read(header.m_testName) || !reader.Read(header.m_rngName) || !reader.Read(header.m_numTests) ||
+        !reader.Read(header.m_numValues) || !reader.Read(header.m_trialsPerChunk) || !reader.Read(header.m_DFTBucketCount) ||
+        !reader.Read(header.m_normalizeMode) || !reader.Read(trackPercentiles))
+        return false;
+
+    return header.m_testName == expected.m_testName &&
+        header.m_rngName == expected.m_rngName &&
+        header.m_numTests == expected.m_numTests &&
+        header.m_numValues == expected.m_numValues &&
+        header.m_trialsPerChunk == expected.m_trialsPerChunk &&
+        header.m_DFTBucketCount == expected.m_DFTBucketCount &&
+        header.m_normalizeMode == expected.m_normalizeMode &&
+        (trackPercentiles != 0) == expected.m_trackPercentiles;
+}
+
+inline bool SaveCheckpoint(const char* fileName, const CheckpointHeader& header, size_t nextChunk, const SpectrumAccumulator& total,
+    const std::vector<double>& firstValues, const std::vector<double>& firstDFT)
+{
+    CheckpointWriter writer;
+    WriteCheckpointHeader(writer, header);
+    writer.Write(uint64_t(nextChunk));
+    total.Write(writer);
+    writer.Write(firstValues);
+    writer.Write(firstDFT);
+    return writer.Save(fileName);
+}
+
+// Loads the state saved by SaveCheckpoint, if fileName holds a good checkpoint with the same header. Nothing
+// is changed otherwise.
+inline bool LoadCheckpoint(const char* fileName, const CheckpointHeader& header, size_t& nextChunk, SpectrumAccumulator& total,
+    std::vector<double>& firstValues, std::vector<double>& firstDFT)
+{
+    CheckpointReader reader;
+    if (!reader.Load(fileName) || !ReadCheckpointHeader(reader, header))
+        return false;
+
+    uint64_t savedNextChunk;
+    SpectrumAccumulator savedTotal;
+    std::vector<double> savedFirstValues, savedFirstDFT;
+    if (!reader.Read(savedNextChunk) || !savedTotal.Read(reader) || !reader.Read(savedFirstValues) || !reader.Read(savedFirstDFT))
+        return false;
+
+    nextChunk = size_t(savedNextChunk);
+    total = savedTotal;
+    firstValues.swap(savedFirstValues);
+    firstDFT.swap(savedFirstDFT);
+    return true;
+}
+
+// removes a finished run's checkpoint, and any temporary file left behind
+inline void RemoveCheckpoint(const char* fileName)
+{
+    remove(fileName);
+    remove((std::string(fileName) + ".tmp").c_str());
+}
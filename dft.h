@@ -30,6 +30,20 @@ struct ComplexImage1D
     }
 };
 
+// Scratch buffers for the DFT functions below. Passing the same workspace to every call lets the buffers keep
+// their capacity, so once they have grown to the largest width used the DFTs do no heap allocations.
+// A workspace must not be shared between threads.
+struct DFTWorkspace
+{
+    std::vector<complex_type> spectrum;     // DFT1D
+    std::vector<double> spectraReal;        // DFT1DBatch
+    std::vector<double> spectraImag;
+    std::vector<double> real;               // ImpulseTrainDFT1D
+    std::vector<double> imag;
+    std::vector<double> image;              // ImpulseTrainDFT1D, when it falls back to DFT1D
+    std::vector<double> halfMagnitudes;
+};
+
 double GetMaxMagnitudeDFT(const std::vector<double>& imageSrc)
 {
     double maxMag = 0.0f;
@@ -38,34 +52,195 @@ double GetMaxMagnitudeDFT(const std::vector<double>& imageSrc)
     return maxMag;
 }
 
-void DFT1D(const std::vector<double>& imageSrc, std::vector<double>& magnitudes)
+// Expands the width/2+1 unique magnitudes of the spectrum of a real signal out to all width bins,
+// fftshifted so that DC is in the middle. Bins above the Nyquist frequency mirror the ones below it.
+void MirrorHalfSpectrum(const std::vector<double>& halfMagnitudes, size_t width, std::vector<double>& magnitudes)
 {
-    // convert the source image to double and store it as complex so it can be DFTd
-    size_t width = imageSrc.size();
-    ComplexImage1D complexImageIn(width);
-    for (size_t index = 0, count = width; index < count; ++index)
-        complexImageIn.pixels[index] = imageSrc[index];
+    // destination x reads from source bin (x + width / 2) % width, which wraps around once
+    size_t halfWidth = width / 2;
+    size_t wrapX = width - halfWidth;
+    magnitudes.resize(width, 0.0f);
+    for (size_t x = 0; x < width; ++x)
+    {
+        size_t srcX = (x < wrapX) ? x + halfWidth : x - wrapX;
+        magnitudes[x] = halfMagnitudes[(srcX <= halfWidth) ? srcX : width - srcX];
+    }
+}
 
+// DFTs a real signal and returns the magnitudes of its spectrum with DC zeroed out.
+// Only the width/2+1 unique bins are computed. If fullSpectrum is true they are mirrored
+// back out to all width bins, fftshifted so that DC is in the middle. Otherwise the
+// width/2+1 unique magnitudes are returned, from DC up to the Nyquist frequency.
+void DFT1D(const std::vector<double>& imageSrc, std::vector<double>& magnitudes, DFTWorkspace& workspace, bool fullSpectrum = true)
+{
     // DFT the image to get frequency of the samples
+    size_t width = imageSrc.size();
+    size_t halfWidth = width / 2;
     const char* error = nullptr;
-    ComplexImage1D complexImageOut(width);
-    simple_fft::FFT(complexImageIn, complexImageOut, width, error);
+    std::vector<complex_type>& spectrum = workspace.spectrum;
+    spectrum.resize(halfWidth + 1);
+    simple_fft::RFFT(imageSrc, spectrum, width, error);
 
     // Zero out DC, we don't really care about it, and the value is huge.
-    complexImageOut(0) = 0.0f;
+    spectrum[0] = 0.0f;
 
     // get the magnitudes
+    std::vector<double>& halfMagnitudes = workspace.halfMagnitudes;
+    halfMagnitudes.resize(halfWidth + 1);
+    for (size_t x = 0; x <= halfWidth; ++x)
     {
-        magnitudes.resize(width, 0.0f);
-        double* dest = magnitudes.data();
-        for (size_t x = 0; x < width; ++x)
+        const complex_type& c = spectrum[x];
+        halfMagnitudes[x] = double(sqrt(c.real()*c.real() + c.imag()*c.imag()));
+    }
+
+    if (fullSpectrum)
+        MirrorHalfSpectrum(halfMagnitudes, width, magnitudes);
+    else
+        magnitudes.swap(halfMagnitudes);
+}
+
+// DFTs batchSize real signals of the same width at once, like DFT1D does for one. The signals are interleaved
+// with sample x of signal b at imagesSrc[x * batchSize + b], so the FFT butterflies run across all of them together.
+// magnitudes is grown to hold at least batchSize spectra but never shrunk, so that the spectra past batchSize keep
+// their buffers for later calls with larger batches.
+void DFT1DBatch(const std::vector<double>& imagesSrc, size_t width, size_t batchSize, std::vector<std::vector<double>>& magnitudes, DFTWorkspace& workspace, bool fullSpectrum = true)
+{
+    // DFT the images to get frequency of the samples
+    size_t halfWidth = width / 2;
+    const char* error = nullptr;
+    std::vector<double>& spectraReal = workspace.spectraReal;
+    std::vector<double>& spectraImag = workspace.spectraImag;
+    spectraReal.resize((halfWidth + 1) * batchSize);
+    spectraImag.resize((halfWidth + 1) * batchSize);
+    simple_fft::RFFTBatch(imagesSrc.data(), spectraReal.data(), spectraImag.data(), width, batchSize, error);
+
+    if (magnitudes.size() < batchSize)
+        magnitudes.resize(batchSize);
+    std::vector<double>& halfMagnitudes = workspace.halfMagnitudes;
+    halfMagnitudes.resize(halfWidth + 1);
+    for (size_t batchIndex = 0; batchIndex < batchSize; ++batchIndex)
+    {
+        // Zero out DC, we don't really care about it, and the value is huge.
+        halfMagnitudes[0] = 0.0;
+
+        // get the magnitudes
+        for (size_t x = 1; x <= halfWidth; ++x)
         {
-            size_t srcX = (x + width / 2) % width;
+            double re = spectraReal[x * batchSize + batchIndex];
+            double im = spectraImag[x * batchSize + batchIndex];
+            halfMagnitudes[x] = sqrt(re * re + im * im);
+        }
+
+        if (fullSpectrum)
+            MirrorHalfSpectrum(halfMagnitudes, width, magnitudes[batchIndex]);
+        else
+            magnitudes[batchIndex] = halfMagnitudes;
+    }
+}
+
+// Below this many impulses per log2(width), ImpulseTrainDFT1D sums phasors directly instead of running an FFT
+static const double c_impulseTrainDirectDFTRatio = 0.75;
+
+// Whether ImpulseTrainDFT1D sums phasors directly for this many impulses, rather than running an FFT
+bool IsSparseImpulseTrain(size_t numImpulses, size_t width)
+{
+    size_t log2Width = 0;
+    while ((size_t(1) << log2Width) < width)
+        log2Width++;
 
-            const complex_type& c = complexImageOut(srcX);
-            double mag = double(sqrt(c.real()*c.real() + c.imag()*c.imag()));
-            *dest = mag;
-            ++dest;
+    return double(numImpulses) <= c_impulseTrainDirectDFTRatio * double(log2Width);
+}
+
+// DFTs a signal of the given width which is zero everywhere except for unit impulses at the given
+// positions, returning magnitudes laid out like DFT1D. The positions must be unique and less than width.
+// Every bin of the spectrum of K impulses is a sum of K phasors, which is cheaper to evaluate directly
+// than to FFT the mostly empty signal when K is small compared to log2(width).
+void ImpulseTrainDFT1D(const std::vector<size_t>& impulses, size_t width, std::vector<double>& magnitudes, DFTWorkspace& workspace, bool fullSpectrum = true)
+{
+    // too many impulses, so FFT them instead
+    if (!IsSparseImpulseTrain(impulses.size(), width))
+    {
+        std::vector<double>& imageSrc = workspace.image;
+        imageSrc.assign(width, 0.0f);
+        for (size_t impulse : impulses)
+            imageSrc[impulse] = 1.0f;
+        DFT1D(imageSrc, magnitudes, workspace, fullSpectrum);
+        return;
+    }
+
+    // exp(-2*pi*i*k/width) for every k in [0, width)
+    thread_local std::vector<double> cosTable, sinTable;
+    if (cosTable.size() != width)
+    {
+        cosTable.resize(width);
+        sinTable.resize(width);
+        for (size_t k = 0; k < width; ++k)
+        {
+            double angle = -2.0 * M_PI * double(k) / double(width);
+            cosTable[k] = cos(angle);
+            sinTable[k] = sin(angle);
+        }
+    }
+
+    // bin k gets the phasor exp(-2*pi*i*k*p/width) from an impulse at position p. Walking the bins in order
+    // rotates that phasor by p table entries each step, which keeps every term exact instead of accumulating
+    // error through repeated complex multiplies.
+    size_t halfWidth = width / 2;
+    std::vector<double>& real = workspace.real;
+    std::vector<double>& imag = workspace.imag;
+    real.assign(halfWidth + 1, 0.0);
+    imag.assign(halfWidth + 1, 0.0);
+    const double* cosData = cosTable.data();
+    const double* sinData = sinTable.data();
+    size_t impulseIndex = 0;
+
+    // four impulses at a time, so each pass over the bins does four times the work per accumulator load and store
+    for (; impulseIndex + 4 <= impulses.size(); impulseIndex += 4)
+    {
+        size_t step[4], tableIndex[4] = { 0, 0, 0, 0 };
+        for (size_t lane = 0; lane < 4; ++lane)
+            step[lane] = impulses[impulseIndex + lane];
+
+        for (size_t k = 0; k <= halfWidth; ++k)
+        {
+            double re = 0.0, im = 0.0;
+            for (size_t lane = 0; lane < 4; ++lane)
+            {
+                re += cosData[tableIndex[lane]];
+                im += sinData[tableIndex[lane]];
+                tableIndex[lane] += step[lane];
+                tableIndex[lane] -= (tableIndex[lane] >= width) ? width : 0;
+            }
+            real[k] += re;
+            imag[k] += im;
+        }
+    }
+
+    for (; impulseIndex < impulses.size(); ++impulseIndex)
+    {
+        size_t step = impulses[impulseIndex];
+        size_t tableIndex = 0;
+        for (size_t k = 0; k <= halfWidth; ++k)
+        {
+            real[k] += cosData[tableIndex];
+            imag[k] += sinData[tableIndex];
+            tableIndex += step;
+            tableIndex -= (tableIndex >= width) ? width : 0;
         }
     }
+
+    // Zero out DC, we don't really care about it, and the value is huge.
+    real[0] = 0.0;
+    imag[0] = 0.0;
+
+    // get the magnitudes, in the same layout DFT1D uses
+    std::vector<double>& halfMagnitudes = workspace.halfMagnitudes;
+    halfMagnitudes.resize(halfWidth + 1);
+    for (size_t x = 0; x <= halfWidth; ++x)
+        halfMagnitudes[x] = sqrt(real[x] * real[x] + imag[x] * imag[x]);
+
+    if (fullSpectrum)
+        MirrorHalfSpectrum(halfMagnitudes, width, magnitudes);
+    else
+        magnitudes.swap(halfMagnitudes);
 }
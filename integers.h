@@ -0,0 +1,307 @@
+#pragma once
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// Integer types wider than int64 for the sequence generators, and a compact approximation to store their terms in:
+//  - Int128: __int128 where the compiler has it, FixedInt<2> otherwise (MSVC).
+//  - FixedInt<W>: a W limb two's complement integer which wraps at 64 * W bits like the built in types.
+//  - BigInt: a two's complement integer which grows as needed, so it never wraps.
+// Every type supports AddOrSubtract(out, a, b, negate), which is a + b when negate is 0 and a - b when it is all
+// ones, done without branching on the sign the same way the int64 generators do it.
+
+// A double mantissa and a 64 bit exponent, for values far beyond the range of a double. The value is
+// m_mantissa * 2^m_exponent, with the mantissa 0 or of magnitude in [0.5, 1) like frexp gives.
+struct ScaledDouble
+{
+    double m_mantissa;
+    int64_t m_exponent;
+};
+
+// 2^exponent, for exponent in [-1022, 1023]
+inline double PowerOfTwo(int64_t exponent)
+{
+    uint64_t bits = uint64_t(exponent + 1023) << 52;
+    double ret;
+    memcpy(&ret, &bits, sizeof(ret));
+    return ret;
+}
+
+// value * 2^exponent, where value is 0 or a normal double. This is frexp done on the bits of the double, which is
+// several times faster than the library's handling of every special case.
+inline ScaledDouble MakeScaledDouble(double value, int64_t exponent)
+{
+    ScaledDouble ret = { 0.0, 0 };
+    if (value == 0.0)
+        return ret;
+
+    const uint64_t exponentMask = uint64_t(0x7ff) << 52;
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    ret.m_exponent = exponent + int64_t((bits & exponentMask) >> 52) - 1022;
+
+    bits = (bits & ~exponentMask) | (uint64_t(1022) << 52);
+    memcpy(&ret.m_mantissa, &bits, sizeof(bits));
+    return ret;
+}
+
+inline bool operator < (const ScaledDouble& a, const ScaledDouble& b)
+{
+    // unless both are non zero with the same sign, the mantissas' signs decide
+    if (a.m_mantissa == 0.0 || b.m_mantissa == 0.0 || (a.m_mantissa < 0.0) != (b.m_mantissa < 0.0))
+        return a.m_mantissa < b.m_mantissa;
+
+    if (a.m_exponent == b.m_exponent)
+        return a.m_mantissa < b.m_mantissa;
+
+    // a bigger exponent is a bigger magnitude, which is bigger when positive and smaller when negative
+    return (a.m_exponent < b.m_exponent) == (a.m_mantissa > 0.0);
+}
+
+// value / 2^exponent as a double, going to 0 for values too small to matter
+inline double ScaledToDouble(const ScaledDouble& value, int64_t exponent)
+{
+    int64_t shift = value.m_exponent - exponent;
+    if (shift < -1022)
+        return 0.0;
+    return value.m_mantissa * PowerOfTwo(std::min<int64_t>(shift, 1023));
+}
+
+// The full sum of a, b and carry, returning the low 64 bits and leaving the carry out in carry
+inline uint64_t AddWithCarry(uint64_t a, uint64_t b, uint64_t& carry)
+{
+    uint64_t sum = a + b;
+    uint64_t carryOut = (sum < a);
+    sum += carry;
+    carryOut |= (sum < carry);
+    carry = carryOut;
+    return sum;
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+
+template <size_t W>
+struct FixedInt
+{
+    uint64_t m_limbs[W];
+
+    FixedInt() = default;
+
+    FixedInt(int64_t value)
+    {
+        m_limbs[0] = uint64_t(value);
+        for (size_t index = 1; index < W; ++index)
+            m_limbs[index] = (value < 0) ? ~uint64_t(0) : 0;
+    }
+
+    bool IsNegative() const
+    {
+        return int64_t(m_limbs[W - 1]) < 0;
+    }
+};
+
+template <size_t W>
+inline void AddOrSubtract(FixedInt<W>& out, const FixedInt<W>& a, const FixedInt<W>& b, uint64_t negate)
+{
+    // a + (b ^ negate) + (negate & 1) is a + b or a + ~b + 1 = a - b
+    uint64_t carry = negate & 1;
+    for (size_t index = 0; index < W; ++index)
+        out.m_limbs[index] = AddWithCarry(a.m_limbs[index], b.m_limbs[index] ^ negate, carry);
+}
+
+template <size_t W>
+inline FixedInt<W> operator - (const FixedInt<W>& a, const FixedInt<W>& b)
+{
+    FixedInt<W> ret;
+    AddOrSubtract(ret, a, b, ~uint64_t(0));
+    return ret;
+}
+
+template <size_t W>
+inline bool operator < (const FixedInt<W>& a, const FixedInt<W>& b)
+{
+    if (a.IsNegative() != b.IsNegative())
+        return a.IsNegative();
+
+    // with equal signs the two's complement limbs compare like unsigned ones
+    for (size_t index = W; index-- > 0;)
+    {
+        if (a.m_limbs[index] != b.m_limbs[index])
+            return a.m_limbs[index] < b.m_limbs[index];
+    }
+    return false;
+}
+
+template <size_t W>
+inline double ToDouble(const FixedInt<W>& value)
+{
+    bool negative = value.IsNegative();
+    FixedInt<W> magnitude = negative ? FixedInt<W>(0) - value : value;
+
+    double ret = 0.0;
+    for (size_t index = W; index-- > 0;)
+        ret = ret * 18446744073709551616.0 + double(magnitude.m_limbs[index]);
+    return negative ? -ret : ret;
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+
+// Little endian 64 bit limbs in two's complement, kept as short as possible: the top limb is only there if the
+// value needs it for its magnitude or its sign. Sums and differences are written into an existing BigInt, whose
+// limbs are reused, so a generator rotating the same few BigInts stops allocating once they are big enough.
+class BigInt
+{
+public:
+    BigInt(int64_t value = 0)
+        : m_limbs(1, uint64_t(value))
+    {
+    }
+
+    bool IsNegative() const
+    {
+        return int64_t(m_limbs.back()) < 0;
+    }
+
+    // The number of bits of a non negative value, not counting leading zeros
+    size_t BitLength() const
+    {
+        size_t index = m_limbs.size();
+        while (index > 0 && m_limbs[index - 1] == 0)
+            index--;
+        if (index == 0)
+            return 0;
+
+        size_t bits = 64 * (index - 1);
+        for (uint64_t top = m_limbs[index - 1]; top; top >>= 1)
+            bits++;
+        return bits;
+    }
+
+    // The value from its top two limbs. A value of more than one limb is at least 2^63 in magnitude, so the bits
+    // below those change it by less than a double can resolve.
+    ScaledDouble ToScaled() const
+    {
+        size_t numLimbs = m_limbs.size();
+        if (numLimbs == 1)
+            return MakeScaledDouble(double(int64_t(m_limbs[0])), 0);
+
+        // the bottom 11 bits of the lower limb are below the precision of a double anyway, and without them it
+        // converts as a signed integer, which doesn't branch on its top bit like an unsigned conversion does
+        double top = double(int64_t(m_limbs[numLimbs - 1])) * 9007199254740992.0 + double(int64_t(m_limbs[numLimbs - 2] >> 11));
+        return MakeScaledDouble(top, int64_t(64 * (numLimbs - 2) + 11));
+    }
+
+    // out = a + b, or a - b when negate is all ones. out must not be a or b.
+    friend void AddOrSubtract(BigInt& out, const BigInt& a, const BigInt& b, uint64_t negate)
+    {
+        const size_t numA = a.m_limbs.size();
+        const size_t numB = b.m_limbs.size();
+        const size_t numCommon = std::min(numA, numB);
+        const size_t numOut = std::max(numA, numB) + 1;
+        out.m_limbs.resize(numOut);
+
+        const uint64_t* limbsA = a.m_limbs.data();
+        const uint64_t* limbsB = b.m_limbs.data();
+        uint64_t* limbsOut = out.m_limbs.data();
+
+        // Each limb takes the carry out of the limb below's own sum, which doesn't depend on the carry into that
+        // limb unless its sum is all ones. That makes the limbs independent of each other, rather than one long
+        // carry chain. When a carry does ripple through an all ones sum, the limbs are redone the exact way.
+        uint64_t carry = negate & 1;
+        uint64_t rippled = 0;
+        for (size_t index = 0; index < numCommon; ++index)
+        {
+            uint64_t limbA = limbsA[index];
+            uint64_t sum = limbA + (limbsB[index] ^ negate);
+            rippled |= (sum == ~uint64_t(0)) & carry;
+            limbsOut[index] = sum + carry;
+            carry = (sum < limbA);
+        }
+
+        if (rippled)
+        {
+            carry = negate & 1;
+            for (size_t index = 0; index < numCommon; ++index)
+                limbsOut[index] = AddWithCarry(limbsA[index], limbsB[index] ^ negate, carry);
+        }
+
+        // the shorter one continues as its sign
+        const uint64_t signA = a.IsNegative() ? ~uint64_t(0) : 0;
+        const uint64_t signB = b.IsNegative() ? ~uint64_t(0) : 0;
+        for (size_t index = numCommon; index < numOut; ++index)
+        {
+            uint64_t limbA = (index < numA) ? limbsA[index] : signA;
+            uint64_t limbB = (index < numB) ? limbsB[index] : signB;
+            limbsOut[index] = AddWithCarry(limbA, limbB ^ negate, carry);
+        }
+
+        out.Trim();
+    }
+
+private:
+    // drop top limbs which only repeat the sign of the one below
+    void Trim()
+    {
+        size_t numLimbs = m_limbs.size();
+        while (numLimbs > 1)
+        {
+            uint64_t top = m_limbs[numLimbs - 1];
+            uint64_t nextSign = (int64_t(m_limbs[numLimbs - 2]) < 0) ? ~uint64_t(0) : 0;
+            if (top != nextSign)
+                break;
+            numLimbs--;
+        }
+        m_limbs.resize(numLimbs);
+    }
+
+    std::vector<uint64_t> m_limbs;
+};
+
+// ---------------------------------------------------------------------------------------------------------------
+
+#if defined(__SIZEOF_INT128__)
+typedef __int128 Int128;
+#else
+typedef FixedInt<2> Int128;
+#endif
+
+// The built in integers, including __int128
+template <typename T>
+inline void AddOrSubtract(T& out, const T& a, const T& b, uint64_t negate)
+{
+    const T mask = T(int64_t(negate));
+    out = a + ((b ^ mask) - mask);
+}
+
+template <typename T>
+inline double ToDouble(const T& value)
+{
+    return double(value);
+}
+
+// What a generator keeps of each term computed as a T. Fixed width terms are kept as they are, while BigInt terms
+// are kept as ScaledDoubles, since keeping every term of a long sequence exactly would take too much memory.
+template <typename T>
+struct StoredValue
+{
+    typedef T type;
+
+    static void Store(T& dest, const T& value)
+    {
+        dest = value;
+    }
+};
+
+template <>
+struct StoredValue<BigInt>
+{
+    typedef ScaledDouble type;
+
+    static void Store(ScaledDouble& dest, const BigInt& value)
+    {
+        dest = value.ToScaled();
+    }
+};
@@ -1,17 +1,43 @@
+#include <assert.h>
+#include <chrono>
+#include <emmintrin.h>
 #include <random>
+#include <string>
 #include <vector>
 
+#include "accumulator.h"
+#include "checkpoint.h"
 #include "dft.h"
 #include "ImageData.h"
+#include "integers.h"
+#include "normalize.h"
+#include "parallel.h"
+#include "primes.h"
+#include "rng.h"
 
 typedef int64_t int64;
 
 // --------------------- DFT Tests
 
 #define DETERMINISTIC() 1
+#define RNG_POLICY() RNG_PHILOX   // RNG_PHILOX, RNG_SPLITMIX or RNG_MT19937 (the original, slow to seed)
+#define DFT_PERCENTILES() 0       // also save the median and 10th to 90th percentile of each bin, in .dftpct.png
+#define CHECKPOINTS() 1           // save progress in out/<name>.checkpoint and resume from it if the run is interrupted
+#define EARLY_STOPPING() 0        // stop a test once every bin's mean is known to within c_earlyStopTolerance
+#define TILED_PLOTS() 0           // draw the DFT plots in tiles across threads, which pays off for plots thousands of pixels wide
 
 static const size_t c_DFTBucketCount = 2048;
 static const size_t c_numTests = 100000;
+static const size_t c_numLongTests = 1000;      // for the 10000 term sequences, whose terms are BigInts
+
+static const size_t c_numThreads = 0;           // 0 to use every hardware thread
+static const size_t c_trialsPerChunk = 1024;    // results depend on this, but not on the thread count
+static const size_t c_testsPerBatch = 8;        // how many tests are FFTd together
+static const double c_checkpointSeconds = 60.0; // the least time between checkpoints, taken after a wave of chunks
+
+static const double c_earlyStopTolerance = 0.01; // the widest 95% confidence interval half width, relative to the mean
+static const double c_earlyStopZ = 1.96;
+static const size_t c_earlyStopMinTests = 4096;  // don't trust the intervals before this many tests
 
 static const size_t c_DFTImageWidth = 512;
 static const size_t c_DFTImageHeight = 128;
@@ -29,6 +55,10 @@ static const size_t c_DFTImageHeight = 128;
 static const size_t c_numCoinTossTests = 10000;  // Do the test this many times
 static const size_t c_numHeadsRequired = 10;    // flip a coin with this many heads, then see how often the next number is heads vs tails
 
+// --------------------- Prime Term Tests
+
+static const size_t c_numPrimeTermTests = 10000; // how many RandomFibonacci sequences to test the terms of for primality
+
 // ---------------------
 
 RGBA DataPointColor(size_t sampleIndex, size_t totalSamples)
@@ -53,16 +83,31 @@ RGBA DataPointColor(size_t sampleIndex, size_t totalSamples)
     return ret;
 }
 
-std::mt19937 GetRNG(size_t index)
+// Where DoTest's images get drawn and saved, off the thread running the tests. main flushes it before exiting.
+WorkQueue& ImageQueue()
+{
+    static WorkQueue queue;
+    return queue;
+}
+
+// Every trial gets the numbers it needs from its own generator, keyed by its test index
+#if RNG_POLICY() == RNG_PHILOX
+typedef PhiloxRNG TrialRNG;
+#elif RNG_POLICY() == RNG_SPLITMIX
+typedef SplitMixRNG TrialRNG;
+#else
+typedef MersenneTwisterRNG TrialRNG;
+#endif
+
+TrialRNG GetRNG(size_t index, uint64_t stream = 0)
 {
 #if DETERMINISTIC()
-    std::seed_seq seq({ (uint32_t)index, (unsigned int)0x65cd8674, (unsigned int)0x7952426c, (unsigned int)0x2a816f2c, (unsigned int)0x689dbc5f, (unsigned int)0xe138d1e5, (unsigned int)0x91da7241, (unsigned int)0x57f2d0e0, (unsigned int)0xed41c211 });
-    std::mt19937 rng(seq);
+    return TrialRNG(uint64_t(index), stream);
 #else
     std::random_device rd;
-    std::mt19937 rng(rd());
+    uint64_t seed = (uint64_t(rd()) << 32) | rd();
+    return TrialRNG(uint64_t(index) ^ seed, stream);
 #endif
-    return rng;
 }
 
 void SaveSamples1D(const std::vector<double>& points, const char* fileName)
@@ -89,19 +134,19 @@ void SaveSamples1D(const std::vector<double>& points, const char* fileName)
     image.Save(fileName);
 }
 
-void SaveDFT1D(const std::vector<double>& dftData, const std::vector<double>& dftStdDevData, size_t imageWidth, size_t imageHeight, const char* fileName, bool showStdDev)
-{
-    // get the maximum magnitude so we can normalize the DFT values
-    double maxMagnitude = GetMaxMagnitudeDFT(dftData);
-    if (showStdDev)
-        maxMagnitude += GetMaxMagnitudeDFT(dftStdDevData);
+// The DFT plots come out the same either way
+#if TILED_PLOTS()
+typedef STiledImageData PlotImage;
+#else
+typedef SImageData PlotImage;
+#endif
 
-    // size and clear the image
-    SImageData image;
+// sizes and clears the image, then draws a dim background grid
+void StartDFT1DImage(PlotImage& image, size_t imageWidth, size_t imageHeight)
+{
     image.Resize(imageWidth, imageHeight);
     image.Fill(RGBA{ 255, 255, 255, 255 });
 
-    // draw a dim background grid
     size_t lineSpacing = imageHeight / 8;
     size_t numRows = imageHeight / lineSpacing;
     size_t numCols = imageWidth / lineSpacing;
@@ -115,114 +160,341 @@ void SaveDFT1D(const std::vector<double>& dftData, const std::vector<double>& df
         int x = int(double(i + 1) * double(lineSpacing));
         image.Box(x, x + 1, 0, imageHeight - 1, RGBA{ 192, 192, 192, 255 });
     }
+}
+
+void SaveDFT1D(const std::vector<double>& dftData, const std::vector<double>& dftStdDevData, size_t imageWidth, size_t imageHeight, const char* fileName, bool showStdDev)
+{
+    // get the maximum magnitude so we can normalize the DFT values
+    double maxMagnitude = GetMaxMagnitudeDFT(dftData);
+    if (showStdDev)
+        maxMagnitude += GetMaxMagnitudeDFT(dftStdDevData);
+
+    PlotImage image;
+    StartDFT1DImage(image, imageWidth, imageHeight);
 
-    // draw the graph
-    int lastX, lastY;
-    int lastStdDevY;
+    // draw the graph, with the standard deviation either side of it under it
+    std::vector<int> xs(dftData.size()), ys(dftData.size()), lowYs, highYs;
     for (size_t index = 0; index < dftData.size(); ++index)
     {
         size_t pixelX = index * imageWidth / dftData.size();
         double f = dftData[index] / maxMagnitude;
         double pixelY = double(imageHeight) - f * double(imageHeight);
+        xs[index] = int(pixelX);
+        ys[index] = int(pixelY);
 
         if (showStdDev)
         {
             double stdDev = dftStdDevData[index] / maxMagnitude;
             int stdDevY = int(stdDev * double(imageHeight));
-
-            if (index > 0)
-            {
-                image.DrawLine(lastX, lastY - lastStdDevY, int(pixelX), int(pixelY) - stdDevY, RGBA{ 128, 128, 128, 255 });
-                image.DrawLine(lastX, lastY + lastStdDevY, int(pixelX), int(pixelY) + stdDevY, RGBA{ 128, 128, 128, 255 });
-            }
-
-            lastStdDevY = stdDevY;
+            lowYs.push_back(ys[index] - stdDevY);
+            highYs.push_back(ys[index] + stdDevY);
         }
+    }
 
-        if (index > 0)
-            image.DrawLine(lastX, lastY, int(pixelX), int(pixelY), RGBA{ 64, 64, 64, 255 });
-        lastX = int(pixelX);
-        lastY = int(pixelY);
+    if (showStdDev)
+    {
+        image.DrawPolyline(xs.data(), lowYs.data(), xs.size(), RGBA{ 128, 128, 128, 255 });
+        image.DrawPolyline(xs.data(), highYs.data(), xs.size(), RGBA{ 128, 128, 128, 255 });
     }
+    image.DrawPolyline(xs.data(), ys.data(), xs.size(), RGBA{ 64, 64, 64, 255 });
 
     // save the image
     image.Save(fileName);
 }
 
-void CalculateDFT1D(const std::vector<double>& values, size_t bucketCount, std::vector<double>& valuesDFTMag)
+// The median of each bin in dark grey, between its low and high percentiles in light grey
+void SaveDFT1DPercentiles(const std::vector<double>& median, const std::vector<double>& low, const std::vector<double>& high, size_t imageWidth, size_t imageHeight, const char* fileName)
+{
+    double maxMagnitude = GetMaxMagnitudeDFT(high);
+
+    PlotImage image;
+    StartDFT1DImage(image, imageWidth, imageHeight);
+
+    std::vector<int> xs(median.size()), ys(median.size()), lowYs(median.size()), highYs(median.size());
+    for (size_t index = 0; index < median.size(); ++index)
+    {
+        xs[index] = int(index * imageWidth / median.size());
+        ys[index] = int(double(imageHeight) - median[index] / maxMagnitude * double(imageHeight));
+        lowYs[index] = int(double(imageHeight) - low[index] / maxMagnitude * double(imageHeight));
+        highYs[index] = int(double(imageHeight) - high[index] / maxMagnitude * double(imageHeight));
+    }
+
+    image.DrawPolyline(xs.data(), lowYs.data(), xs.size(), RGBA{ 128, 128, 128, 255 });
+    image.DrawPolyline(xs.data(), highYs.data(), xs.size(), RGBA{ 128, 128, 128, 255 });
+    image.DrawPolyline(xs.data(), ys.data(), xs.size(), RGBA{ 64, 64, 64, 255 });
+
+    image.Save(fileName);
+}
+
+// returns which buckets of the sample image have a sample in them, sorted and without duplicates
+void GetSampleImpulses(const std::vector<double>& values, size_t bucketCount, std::vector<size_t>& impulses)
+{
+    if (values.size() < bucketCount / 4)
+    {
+        impulses.resize(values.size());
+        for (size_t index = 0; index < values.size(); ++index)
+            impulses[index] = (size_t)Clamp(values[index] * double(bucketCount), 0.0, double(bucketCount - 1));
+        std::sort(impulses.begin(), impulses.end());
+        impulses.erase(std::unique(impulses.begin(), impulses.end()), impulses.end());
+        return;
+    }
+
+    // For longer sequences, mark the buckets hit and then gather the marked ones in order. That gives the same
+    // sorted list of unique buckets without sorting every sample.
+    impulses.assign(bucketCount, 0);
+    for (double value : values)
+        impulses[(size_t)Clamp(value * double(bucketCount), 0.0, double(bucketCount - 1))] = 1;
+
+    size_t numImpulses = 0;
+    for (size_t bucket = 0; bucket < bucketCount; ++bucket)
+    {
+        if (impulses[bucket])
+            impulses[numImpulses++] = bucket;
+    }
+    impulses.resize(numImpulses);
+}
+
+// The buffers used by RunTestBatch. Every batch run with the same TestBatch reuses them, so once they have grown
+// to fit a batch the trials do no heap allocations. The per test vectors are only ever grown, never shrunk, so a
+// smaller batch doesn't free buffers the next full one needs.
+template <typename VALUE>
+struct TestBatch
 {
-    // make an image of the samples
-    std::vector<double> sampleImage(bucketCount, 0.0f);
-    for (const double value : values)
+    DFTWorkspace dft;
+
+    std::vector<std::vector<VALUE>> values;
+    std::vector<std::vector<double>> valuesdouble;
+    std::vector<std::vector<size_t>> impulses;
+    std::vector<std::vector<double>> valuesDFT;
+
+    std::vector<size_t> denseTests;
+    std::vector<double> denseImages;
+    std::vector<std::vector<double>> denseDFTs;
+};
+
+// Runs tests [testBegin, testBegin + testCount), leaving the normalized values and DFT magnitudes of each in batch.
+// The values of the whole batch are generated at once by lambda(values, numValues, testBegin, testCount), so a
+// generator can work on several tests together. Sample images with few enough samples are DFTd on their own by
+// summing phasors, while the rest are interleaved and FFTd together so the butterflies work on all of them at once.
+template <typename VALUE, typename LAMBDA>
+void RunTestBatch(const LAMBDA& lambda, size_t numValues, size_t testBegin, size_t testCount, NormalizeMode mode, TestBatch<VALUE>& batch)
+{
+    if (batch.valuesdouble.size() < testCount)
+    {
+        batch.values.resize(testCount);
+        batch.valuesdouble.resize(testCount);
+        batch.impulses.resize(testCount);
+        batch.valuesDFT.resize(testCount);
+    }
+    batch.denseTests.clear();
+
+    lambda(batch.values, numValues, testBegin, testCount);
+
+    for (size_t batchIndex = 0; batchIndex < testCount; ++batchIndex)
+    {
+        std::vector<double>& valuesdouble = batch.valuesdouble[batchIndex];
+        NormalizeValues(batch.values[batchIndex], valuesdouble, mode);
+
+        GetSampleImpulses(valuesdouble, c_DFTBucketCount, batch.impulses[batchIndex]);
+        if (IsSparseImpulseTrain(batch.impulses[batchIndex].size(), c_DFTBucketCount))
+            ImpulseTrainDFT1D(batch.impulses[batchIndex], c_DFTBucketCount, batch.valuesDFT[batchIndex], batch.dft);
+        else
+            batch.denseTests.push_back(batchIndex);
+    }
+
+    if (batch.denseTests.empty())
+        return;
+
+    // make the interleaved sample images of the dense tests and DFT them together
+    size_t denseCount = batch.denseTests.size();
+    batch.denseImages.assign(c_DFTBucketCount * denseCount, 0.0);
+    for (size_t denseIndex = 0; denseIndex < denseCount; ++denseIndex)
     {
-        size_t x = (size_t)Clamp(value * double(bucketCount), 0.0, double(bucketCount - 1));
-        sampleImage[x] = 1.0f;
+        for (size_t impulse : batch.impulses[batch.denseTests[denseIndex]])
+            batch.denseImages[impulse * denseCount + denseIndex] = 1.0;
     }
 
-    // DFT the image
-    DFT1D(sampleImage, valuesDFTMag);
+    DFT1DBatch(batch.denseImages, c_DFTBucketCount, denseCount, batch.denseDFTs, batch.dft);
+
+    for (size_t denseIndex = 0; denseIndex < denseCount; ++denseIndex)
+        batch.valuesDFT[batch.denseTests[denseIndex]].swap(batch.denseDFTs[denseIndex]);
 }
 
-template <typename LAMBDA>
-void DoTest(const char* name, size_t numTests, size_t numValues, const LAMBDA& lambda)
+// Runs numTests tests, generating the values of each batch of them with
+// lambda(std::vector<std::vector<VALUE>>& values, size_t numValues, size_t testBegin, size_t testCount), which
+// fills values[0] to values[testCount - 1] (values holds at least that many vectors). VALUE is any type
+// NormalizeValues takes, and mode says how the values are mapped onto the sample image.
+template <typename VALUE = int64, typename LAMBDA>
+void DoTestBatched(const char* name, size_t numTests, size_t numValues, const LAMBDA& lambda, NormalizeMode mode = NormalizeMode::Linear)
 {
     printf("%s...\n", name);
-    std::vector<double> averageDFT;
-    std::vector<double> averageDFTSquared;
-    std::vector<double> averageDFTStdDev;
-    for (size_t testIndex = 0; testIndex < numTests; ++testIndex)
+
+    // The tests are split into chunks of c_trialsPerChunk, which run in parallel a wave at a time with each chunk
+    // accumulating into its own SpectrumAccumulator. Chunks are merged into the total in chunk order, so the result
+    // only depends on the chunk size, not on the number of threads or which thread ran which chunk.
+    size_t numThreads = GetNumThreads(c_numThreads);
+    size_t numChunks = (numTests + c_trialsPerChunk - 1) / c_trialsPerChunk;
+    SpectrumAccumulator total;
+    std::vector<SpectrumAccumulator> chunkAccumulators(std::min(numThreads, numChunks));
+#if DFT_PERCENTILES()
+    total.m_trackPercentiles = true;
+    for (SpectrumAccumulator& accumulator : chunkAccumulators)
+        accumulator.m_trackPercentiles = true;
+#endif
+    std::vector<TestBatch<VALUE>> chunkBatches(chunkAccumulators.size());
+    std::vector<double> firstValues;
+    std::vector<double> firstDFT;
+
+    // pick up from the checkpoint of an interrupted run, if there is one
+    size_t firstChunk = 0;
+    char checkpointFileName[1024];
+    sprintf_s(checkpointFileName, "out/%s.checkpoint", name);
+#if CHECKPOINTS()
+    CheckpointHeader checkpointHeader;
+    checkpointHeader.m_testName = name;
+    checkpointHeader.m_rngName = TrialRNG::Name();
+    checkpointHeader.m_numTests = numTests;
+    checkpointHeader.m_numValues = numValues;
+    checkpointHeader.m_trialsPerChunk = c_trialsPerChunk;
+    checkpointHeader.m_DFTBucketCount = c_DFTBucketCount;
+    checkpointHeader.m_normalizeMode = uint64_t(mode);
+    checkpointHeader.m_trackPercentiles = total.m_trackPercentiles;
+    if (LoadCheckpoint(checkpointFileName, checkpointHeader, firstChunk, total, firstValues, firstDFT))
+        printf("  resuming from %s at test %zu\n", checkpointFileName, std::min(firstChunk * c_trialsPerChunk, numTests));
+    auto lastCheckpoint = std::chrono::steady_clock::now();
+#endif
+
+    bool stopped = false;
+    for (size_t waveStart = firstChunk; waveStart < numChunks; waveStart += chunkAccumulators.size())
     {
-        std::vector<int64> values;
-        lambda(values, numValues, testIndex);
+        size_t waveSize = std::min(chunkAccumulators.size(), numChunks - waveStart);
+        ParallelFor(waveSize, numThreads,
+            [&] (size_t waveIndex)
+            {
+                SpectrumAccumulator& accumulator = chunkAccumulators[waveIndex];
+                accumulator.Clear();
+
+                // each wave slot keeps its buffers from one wave to the next
+                TestBatch<VALUE>& batch = chunkBatches[waveIndex];
+
+                size_t chunkIndex = waveStart + waveIndex;
+                size_t testBegin = chunkIndex * c_trialsPerChunk;
+                size_t testEnd = std::min(testBegin + c_trialsPerChunk, numTests);
+                for (size_t batchBegin = testBegin; batchBegin < testEnd; batchBegin += c_testsPerBatch)
+                {
+                    size_t batchCount = std::min(c_testsPerBatch, testEnd - batchBegin);
+                    RunTestBatch(lambda, numValues, batchBegin, batchCount, mode, batch);
+
+                    for (size_t batchIndex = 0; batchIndex < batchCount; ++batchIndex)
+                        accumulator.Add(batch.valuesDFT[batchIndex]);
+
+                    // keep the first test around to show what a single test looks like
+                    if (batchBegin == 0)
+                    {
+                        firstValues = batch.valuesdouble[0];
+                        firstDFT = batch.valuesDFT[0];
+                    }
+                }
+            }
+        );
 
-        int64 min = values[0];
-        int64 max = values[0];
-        for (int64 value : values)
+        // Early stopping is checked after every chunk, in chunk order, so it stops after the same chunk whatever
+        // the number of threads. The rest of a wave after that chunk is thrown away.
+        for (size_t waveIndex = 0; waveIndex < waveSize && !stopped; ++waveIndex)
         {
-            min = std::min(min, value);
-            max = std::max(max, value);
+            total.Merge(chunkAccumulators[waveIndex]);
+#if EARLY_STOPPING()
+            stopped = total.m_count >= c_earlyStopMinTests && total.GetMaxRelativeHalfWidth(c_earlyStopZ) < c_earlyStopTolerance;
+#endif
         }
+        if (stopped)
+            break;
 
-        std::vector<double> valuesdouble(values.size());
-        for (size_t index = 0; index < values.size(); ++index)
-            valuesdouble[index] = double(double(values[index] - min) / double(max - min));
+#if CHECKPOINTS()
+        auto now = std::chrono::steady_clock::now();
+        if (waveStart + waveSize < numChunks && std::chrono::duration<double>(now - lastCheckpoint).count() >= c_checkpointSeconds)
+        {
+            if (!SaveCheckpoint(checkpointFileName, checkpointHeader, waveStart + waveSize, total, firstValues, firstDFT))
+                printf("  couldn't save %s\n", checkpointFileName);
+            lastCheckpoint = now;
+        }
+#endif
+    }
+
+#if CHECKPOINTS()
+    RemoveCheckpoint(checkpointFileName);
+#endif
 
-        std::vector<double> valuesDFT;
-        CalculateDFT1D(valuesdouble, c_DFTBucketCount, valuesDFT);
+#if EARLY_STOPPING()
+    if (numTests > 1)
+    {
+        printf("  ran %zu of %zu tests%s, widest confidence interval +/- %.2f%% of the mean\n", total.m_count, numTests,
+            stopped ? " (converged)" : "", 100.0 * total.GetMaxRelativeHalfWidth(c_earlyStopZ));
+    }
+#endif
 
-        if (averageDFT.size() == 0)
+    // The images are drawn and saved on the image queue while the next test runs, each job owning the data it
+    // plots, moved in since the test is done with it
+    std::string path = std::string("out/") + name;
+    ImageQueue().Push([firstDFT = std::move(firstDFT), path] ()
         {
-            averageDFT.resize(valuesDFT.size(), 0.0f);
-            averageDFTSquared.resize(valuesDFT.size(), 0.0f);
-            averageDFTStdDev.resize(valuesDFT.size(), 0.0f);
+            SaveDFT1D(firstDFT, std::vector<double>(), c_DFTImageWidth, c_DFTImageHeight, (path + ".dft.png").c_str(), false);
         }
+    );
 
-        for (size_t index = 0; index < valuesDFT.size(); ++index)
+    ImageQueue().Push([firstValues = std::move(firstValues), path] ()
         {
-            averageDFT[index] = Lerp(averageDFT[index], valuesDFT[index], 1.0 / double(testIndex + 1));
-            averageDFTSquared[index] = Lerp(averageDFTSquared[index], valuesDFT[index] * valuesDFT[index], 1.0 / double(testIndex + 1));
+            SaveSamples1D(firstValues, (path + ".png").c_str());
         }
+    );
 
-        char filename[1024];
-        if (testIndex == 0)
-        {
-            sprintf_s(filename, "out/%s.dft.png", name);
-            SaveDFT1D(averageDFT, averageDFTStdDev, c_DFTImageWidth, c_DFTImageHeight, filename, false);
+    if (numTests > 1)
+    {
+        std::vector<double> averageDFTStdDev;
+        total.GetStdDev(averageDFTStdDev);
 
-            sprintf_s(filename, "out/%s.png", name);
-            SaveSamples1D(valuesdouble, filename);
-        }
-        else if (testIndex == c_numTests - 1)
-        {
-            for (size_t index = 0; index < valuesDFT.size(); ++index)
-                averageDFTStdDev[index] = sqrt(abs(averageDFTSquared[index] - averageDFT[index] * averageDFT[index]));
+        ImageQueue().Push([averageDFT = std::move(total.m_mean), averageDFTStdDev = std::move(averageDFTStdDev), path] ()
+            {
+                SaveDFT1D(averageDFT, averageDFTStdDev, c_DFTImageWidth, c_DFTImageHeight, (path + ".dftavg.png").c_str(), true);
+            }
+        );
 
-            sprintf_s(filename, "out/%s.dftavg.png", name);
-            SaveDFT1D(averageDFT, averageDFTStdDev, c_DFTImageWidth, c_DFTImageHeight, filename, true);
-        }
+#if DFT_PERCENTILES()
+        std::vector<double> median, low, high;
+        total.GetPercentile(50.0, median);
+        total.GetPercentile(10.0, low);
+        total.GetPercentile(90.0, high);
+
+        ImageQueue().Push([median = std::move(median), low = std::move(low), high = std::move(high), path] ()
+            {
+                SaveDFT1DPercentiles(median, low, high, c_DFTImageWidth, c_DFTImageHeight, (path + ".dftpct.png").c_str());
+            }
+        );
+#endif
     }
 }
 
+// Runs numTests tests, generating the values of each one on its own with
+// lambda(std::vector<VALUE>& values, size_t numValues, size_t testIndex)
+template <typename VALUE = int64, typename LAMBDA>
+void DoTest(const char* name, size_t numTests, size_t numValues, const LAMBDA& lambda, NormalizeMode mode = NormalizeMode::Linear)
+{
+    DoTestBatched<VALUE>(name, numTests, numValues,
+        [&] (std::vector<std::vector<VALUE>>& values, size_t numValues, size_t testBegin, size_t testCount)
+        {
+            for (size_t batchIndex = 0; batchIndex < testCount; ++batchIndex)
+            {
+                values[batchIndex].clear();
+                lambda(values[batchIndex], numValues, testBegin + batchIndex);
+            }
+        },
+        mode
+    );
+}
+
+// values[i] = values[i-2] +/- values[i-1], adding when the next random bit is 1. The sign is applied without a
+// branch: negate is all ones to subtract and 0 to add, and (x ^ negate) - negate is then -x or x. The arithmetic
+// is on uint64 so it wraps rather than overflowing like int64 could, and the bits come 64 at a time.
 void RandomFibonacci(std::vector<int64>& values, size_t numValues, size_t rngIndex)
 {
     values.resize(numValues);
@@ -230,72 +502,198 @@ void RandomFibonacci(std::vector<int64>& values, size_t numValues, size_t rngInd
     values[0] = 1;
     values[1] = 1;
 
-    std::mt19937 rng = GetRNG(rngIndex);
-    std::uniform_int_distribution<uint32_t> dist;
+    TrialRNG rng = GetRNG(rngIndex);
 
-    uint32_t rngValueBitsLeft = 0;
-    uint32_t rngValue = 0;
+    uint64_t a = 1;
+    uint64_t b = 1;
+    for (size_t wordBegin = 2; wordBegin < numValues; wordBegin += 64)
+    {
+        uint64_t bits = RandomBits64(rng);
+        size_t wordEnd = std::min(wordBegin + 64, numValues);
+        for (size_t index = wordBegin; index < wordEnd; ++index)
+        {
+            uint64_t negate = (bits & 1) - 1;
+            uint64_t next = a + ((b ^ negate) - negate);
+            bits >>= 1;
 
-    for (size_t index = 2; index < numValues; ++index)
+            values[index] = int64(next);
+            a = b;
+            b = next;
+        }
+    }
+}
+
+// One step of the branchless RandomFibonacci recurrence on two lanes, storing the new values at
+// evenValues[index] and oddValues[index]
+inline void RandomFibonacciStep2(__m128i& a, __m128i& b, __m128i& bits, int64* evenValues, int64* oddValues, size_t index)
+{
+    const __m128i one = _mm_set1_epi64x(1);
+    __m128i negate = _mm_sub_epi64(_mm_and_si128(bits, one), one);
+    __m128i next = _mm_add_epi64(a, _mm_sub_epi64(_mm_xor_si128(b, negate), negate));
+    bits = _mm_srli_epi64(bits, 1);
+    a = b;
+    b = next;
+
+    _mm_storel_epi64((__m128i*)&evenValues[index], next);
+    _mm_storeh_pd((double*)&oddValues[index], _mm_castsi128_pd(next));
+}
+
+// RandomFibonacci of c_fibonacciLanes consecutive rng indices at once, giving each the same values it would get
+// on its own. The random bits of every lane are drawn up front, then each step runs the branchless recurrence on
+// all lanes with SSE2, two lanes to a register, so the lanes' dependency chains overlap instead of each trial
+// waiting on its own. The lanes are written out by hand to keep all of their state in registers.
+static const size_t c_fibonacciLanes = 8;
+
+void RandomFibonacciLanes(std::vector<int64>* values, size_t numValues, size_t firstRngIndex)
+{
+    static_assert(c_fibonacciLanes == 8, "RandomFibonacciLanes is written out for 8 lanes");
+    const size_t L = c_fibonacciLanes;
+    size_t numWords = (numValues + 61) / 64;
+
+    thread_local std::vector<uint64_t> laneBits;
+    laneBits.resize(numWords * L);
+
+    int64* v[L];
+    for (size_t lane = 0; lane < L; ++lane)
     {
-        if (rngValueBitsLeft == 0)
+        values[lane].resize(numValues);
+        values[lane][0] = 1;
+        values[lane][1] = 1;
+        v[lane] = values[lane].data();
+
+        TrialRNG rng = GetRNG(firstRngIndex + lane);
+        for (size_t word = 0; word < numWords; ++word)
+            laneBits[word * L + lane] = RandomBits64(rng);
+    }
+
+    __m128i a0 = _mm_set1_epi64x(1), a1 = a0, a2 = a0, a3 = a0;
+    __m128i b0 = a0, b1 = a0, b2 = a0, b3 = a0;
+    for (size_t word = 0; word < numWords; ++word)
+    {
+        const __m128i* wordBits = (const __m128i*)&laneBits[word * L];
+        __m128i bits0 = _mm_loadu_si128(wordBits + 0);
+        __m128i bits1 = _mm_loadu_si128(wordBits + 1);
+        __m128i bits2 = _mm_loadu_si128(wordBits + 2);
+        __m128i bits3 = _mm_loadu_si128(wordBits + 3);
+
+        size_t wordBegin = 2 + word * 64;
+        size_t wordEnd = std::min(wordBegin + 64, numValues);
+        for (size_t index = wordBegin; index < wordEnd; ++index)
         {
-            rngValue = dist(rng);
-            rngValueBitsLeft = 32;
+            RandomFibonacciStep2(a0, b0, bits0, v[0], v[1], index);
+            RandomFibonacciStep2(a1, b1, bits1, v[2], v[3], index);
+            RandomFibonacciStep2(a2, b2, bits2, v[4], v[5], index);
+            RandomFibonacciStep2(a3, b3, bits3, v[6], v[7], index);
         }
-        bool randomBit = rngValue & 1;
-        rngValue >>= 1;
-        rngValueBitsLeft--;
+    }
+}
 
-        if (randomBit)
-            values[index] = values[index - 2] + values[index - 1];
-        else
-            values[index] = values[index - 2] - values[index - 1];
+// A batch of RandomFibonacci tests, c_fibonacciLanes at a time with the rest done one by one
+void RandomFibonacciBatch(std::vector<std::vector<int64>>& values, size_t numValues, size_t testBegin, size_t testCount)
+{
+    size_t batchIndex = 0;
+    for (; batchIndex + c_fibonacciLanes <= testCount; batchIndex += c_fibonacciLanes)
+        RandomFibonacciLanes(&values[batchIndex], numValues, testBegin + batchIndex);
+
+    for (; batchIndex < testCount; ++batchIndex)
+        RandomFibonacci(values[batchIndex], numValues, testBegin + batchIndex);
+}
+
+// How many terms of RandomFibonacci or Fibonacci fit in a T. The nth term is at most the nth Fibonacci number in
+// magnitude, and normalizing takes the difference of two terms, so every term must be below 2^(bits - 2).
+template <typename T>
+size_t MaxFibonacciTerms()
+{
+    const size_t bits = sizeof(T) * 8;
+    BigInt a(1), b(1), next;
+    size_t numTerms = 2;
+    while (true)
+    {
+        AddOrSubtract(next, a, b, 0);
+        if (next.BitLength() > bits - 2)
+            return numTerms;
+        numTerms++;
+        std::swap(a, b);
+        std::swap(b, next);
     }
 }
 
-void Fibonacci(std::vector<int64>& values, size_t numValues)
+template <>
+size_t MaxFibonacciTerms<BigInt>()
+{
+    return size_t(-1);
+}
+
+// RandomFibonacci computed in T, for sequences longer than an int64 can hold. T is Int128, a FixedInt or a
+// BigInt, and the terms are kept as StoredValue<T> describes. The terms are computed into three Ts which are
+// rotated, rather than into values, so BigInts reuse their limbs.
+template <typename T>
+void RandomFibonacci(std::vector<typename StoredValue<T>::type>& values, size_t numValues, size_t rngIndex)
 {
+    assert(numValues <= MaxFibonacciTerms<T>());
+
     values.resize(numValues);
 
-    values[0] = 1;
-    values[1] = 1;
+    T a(1), b(1), next;
+    StoredValue<T>::Store(values[0], a);
+    StoredValue<T>::Store(values[1], b);
 
-    for (size_t index = 2; index < numValues; ++index)
-        values[index] = values[index - 2] + values[index - 1];
+    TrialRNG rng = GetRNG(rngIndex);
+    for (size_t wordBegin = 2; wordBegin < numValues; wordBegin += 64)
+    {
+        uint64_t bits = RandomBits64(rng);
+        size_t wordEnd = std::min(wordBegin + 64, numValues);
+        for (size_t index = wordBegin; index < wordEnd; ++index)
+        {
+            AddOrSubtract(next, a, b, (bits & 1) - 1);
+            bits >>= 1;
+
+            StoredValue<T>::Store(values[index], next);
+            std::swap(a, b);
+            std::swap(b, next);
+        }
+    }
 }
 
-bool IsPrime(int64 value)
+template <typename T>
+void Fibonacci(std::vector<typename StoredValue<T>::type>& values, size_t numValues)
 {
-    if (value < 2)
-        return false;
+    assert(numValues <= MaxFibonacciTerms<T>());
+
+    values.resize(numValues);
 
-    if (value <= 3)
-        return true;
+    T a(1), b(1), next;
+    StoredValue<T>::Store(values[0], a);
+    StoredValue<T>::Store(values[1], b);
 
-    int64 maxCheck = ((int64)sqrt((double)value));
-    for (int64 i = 2; i <= maxCheck; ++i)
+    for (size_t index = 2; index < numValues; ++index)
     {
-        if ((value % i) == 0)
-            return false;
+        AddOrSubtract(next, a, b, 0);
+        StoredValue<T>::Store(values[index], next);
+        std::swap(a, b);
+        std::swap(b, next);
     }
-    return true;
 }
 
+// the first numValues primes, sieved up to the upper bound on the last one
 void Primes(std::vector<int64>& values, size_t numValues)
 {
-    int64 value = 1;
-    while (values.size() < numValues)
-    {
-        if (IsPrime(value))
-            values.push_back(value);
-        value++;
-    }
+    if (numValues == 0)
+        return;
+
+    values.reserve(numValues);
+    ForEachPrime(NthPrimeUpperBound(numValues),
+        [&] (uint64_t prime)
+        {
+            values.push_back(int64(prime));
+            return values.size() < numValues;
+        }
+    );
 }
 
 void UniformWhiteNoise(std::vector<int64>& values, size_t numValues, size_t rngIndex)
 {
-    std::mt19937 rng = GetRNG(rngIndex);
+    TrialRNG rng = GetRNG(rngIndex);
     std::uniform_int_distribution<int64> dist;
 
     values.resize(numValues);
@@ -356,6 +754,27 @@ void DoCoinTossTest()
     printf("%zu times flipping %zu heads in a row. The next value was heads %0.2f percent of the time.\n\n", c_numCoinTossTests, c_numHeadsRequired, percent);
 }
 
+// how often the magnitude of a RandomFibonacci term is prime
+void DoRandomFibonacciPrimesTest()
+{
+    std::vector<int64> values;
+    size_t termCount = 0;
+    size_t primeCount = 0;
+    for (size_t index = 0; index < c_numPrimeTermTests; ++index)
+    {
+        RandomFibonacci(values, 90, index);
+        for (int64 value : values)
+        {
+            if (IsPrime((value < 0) ? -value : value))
+                primeCount++;
+        }
+        termCount += values.size();
+    }
+
+    float percent = 100.0f * float(primeCount) / float(termCount);
+    printf("%zu of %zu RandomFibonacci terms were prime in magnitude, %0.2f percent.\n\n", primeCount, termCount, percent);
+}
+
 int main(int argc, char** argv)
 {
     DoCoinTossTest();
@@ -364,11 +783,13 @@ int main(int argc, char** argv)
     DoCoinTossTest();
     DoCoinTossTest();
 
+    DoRandomFibonacciPrimesTest();
+
     // test RandomFibonacci
-    DoTest("RandomFibonacci", c_numTests, 90,
-        [] (std::vector<int64>& values, size_t numValues, size_t testIndex)
+    DoTestBatched("RandomFibonacci", c_numTests, 90,
+        [] (std::vector<std::vector<int64>>& values, size_t numValues, size_t testBegin, size_t testCount)
         {
-            RandomFibonacci(values, numValues, testIndex);
+            RandomFibonacciBatch(values, numValues, testBegin, testCount);
         }
     );
 
@@ -410,9 +831,49 @@ int main(int argc, char** argv)
     DoTest("Fibonacci", 1, 90,
         [](std::vector<int64>& values, size_t numValues, size_t testIndex)
         {
-            Fibonacci(values, numValues);
+            Fibonacci<int64>(values, numValues);
+        }
+    );
+
+    // longer sequences, in wider integers
+    DoTest<Int128>("RandomFibonacci180", c_numTests, 180,
+        [] (std::vector<Int128>& values, size_t numValues, size_t testIndex)
+        {
+            RandomFibonacci<Int128>(values, numValues, testIndex);
+        }
+    );
+
+    DoTest<ScaledDouble>("RandomFibonacci10000", c_numLongTests, 10000,
+        [] (std::vector<ScaledDouble>& values, size_t numValues, size_t testIndex)
+        {
+            RandomFibonacci<BigInt>(values, numValues, testIndex);
+        }
+    );
+
+    DoTest<ScaledDouble>("Fibonacci10000", 1, 10000,
+        [](std::vector<ScaledDouble>& values, size_t numValues, size_t /*testIndex*/)
+        {
+            Fibonacci<BigInt>(values, numValues);
         }
     );
 
+    // the same on a log scale, which keeps the exponential growth from putting nearly every sample in the first bucket
+    DoTest("FibonacciLog", 1, 90,
+        [](std::vector<int64>& values, size_t numValues, size_t /*testIndex*/)
+        {
+            Fibonacci<int64>(values, numValues);
+        },
+        NormalizeMode::LogMagnitude
+    );
+
+    DoTest<ScaledDouble>("RandomFibonacci10000Log", c_numLongTests, 10000,
+        [] (std::vector<ScaledDouble>& values, size_t numValues, size_t testIndex)
+        {
+            RandomFibonacci<BigInt>(values, numValues, testIndex);
+        },
+        NormalizeMode::LogMagnitude
+    );
+
+    ImageQueue().Flush();
     return 0;
 }
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <algorithm>
+#include <emmintrin.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "integers.h"
+
+// Mapping the terms of a sequence onto [0, 1] before they become a sample image, the smallest term going to 0 and
+// the biggest to 1. NormalizeMode::LogMagnitude first maps every term v to sign(v) * log2(1 + |v|), so sequences
+// which grow exponentially, like Fibonacci, spread out instead of all but the last few terms landing in the first
+// bucket.
+//
+// int64 terms go through two vectorizable passes: one finding the min and max together, and one taking every
+// term's difference from the min and dividing it by the range. A true single pass isn't possible since the scale
+// depends on the last term as much as the first, but the first pass only reads the terms and the second streams
+// straight through them, two terms at a time with SSE2. The differences are taken as uint64, which holds any
+// int64 range without overflowing, and converted to double with the same rounding as a plain conversion, using
+// only operations SSE2 has, so the results match the scalar version exactly.
+
+enum class NormalizeMode
+{
+    Linear,
+    LogMagnitude
+};
+
+// A uint64 to double conversion, correctly rounded like double(value), which compilers can vectorize without
+// AVX-512. Each 32 bit half becomes an exact double by putting it in the mantissa of 2^52 and subtracting 2^52,
+// and the high half times 2^32 stays exact, so adding the halves is the only rounding.
+inline double Uint64ToDouble(uint64_t value)
+{
+    const uint64_t c_twoTo52Bits = 0x4330000000000000ull;
+    const double c_twoTo52 = 4503599627370496.0;
+
+    uint64_t highBits = c_twoTo52Bits | (value >> 32);
+    uint64_t lowBits = c_twoTo52Bits | (value & 0xffffffffull);
+    double high, low;
+    memcpy(&high, &highBits, sizeof(high));
+    memcpy(&low, &lowBits, sizeof(low));
+    return (high - c_twoTo52) * 4294967296.0 + (low - c_twoTo52);
+}
+
+// sign(value) * log2(1 + |value|)
+template <typename VALUE>
+double SignedLogMagnitude(const VALUE& value)
+{
+    double d = ToDouble(value);
+    double logMagnitude = log2(1.0 + fabs(d));
+    return (d < 0.0) ? -logMagnitude : logMagnitude;
+}
+
+inline double SignedLogMagnitude(const ScaledDouble& value)
+{
+    // past 2^60, adding 1 changes nothing a double can hold, and the log comes from the exponent without
+    // ever making the value itself
+    if (value.m_exponent <= 60)
+        return SignedLogMagnitude(ScaledToDouble(value, 0));
+
+    double logMagnitude = log2(fabs(value.m_mantissa)) + double(value.m_exponent);
+    return (value.m_mantissa < 0.0) ? -logMagnitude : logMagnitude;
+}
+
+// The min and max of doubles, in place, onto [0, 1]
+inline void NormalizeDoubles(std::vector<double>& values)
+{
+    double min = values[0];
+    double max = values[0];
+    for (double value : values)
+    {
+        min = std::min(min, value);
+        max = std::max(max, value);
+    }
+
+    double range = max - min;
+    for (double& value : values)
+        value = (value - min) / range;
+}
+
+template <typename VALUE>
+void NormalizeLogMagnitude(const std::vector<VALUE>& values, std::vector<double>& valuesdouble)
+{
+    valuesdouble.resize(values.size());
+    for (size_t index = 0; index < values.size(); ++index)
+        valuesdouble[index] = SignedLogMagnitude(values[index]);
+    NormalizeDoubles(valuesdouble);
+}
+
+// The wider integer types. The differences from the smallest are taken in VALUE, so they are exact up to the one
+// rounding to double.
+template <typename VALUE>
+void NormalizeValues(const std::vector<VALUE>& values, std::vector<double>& valuesdouble, NormalizeMode mode = NormalizeMode::Linear)
+{
+    if (mode == NormalizeMode::LogMagnitude)
+    {
+        NormalizeLogMagnitude(values, valuesdouble);
+        return;
+    }
+
+    VALUE min = values[0];
+    VALUE max = values[0];
+    for (const VALUE& value : values)
+    {
+        if (value < min)
+            min = value;
+        if (max < value)
+            max = value;
+    }
+
+    double range = ToDouble(VALUE(max - min));
+    valuesdouble.resize(values.size());
+    for (size_t index = 0; index < values.size(); ++index)
+        valuesdouble[index] = ToDouble(VALUE(values[index] - min)) / range;
+}
+
+inline void NormalizeValues(const std::vector<int64_t>& values, std::vector<double>& valuesdouble, NormalizeMode mode = NormalizeMode::Linear)
+{
+    if (mode == NormalizeMode::LogMagnitude)
+    {
+        NormalizeLogMagnitude(values, valuesdouble);
+        return;
+    }
+
+    // two independent mins and maxes, so the comparisons don't all wait on each other
+    const int64_t* data = values.data();
+    const size_t count = values.size();
+    int64_t min0 = data[0], min1 = data[0];
+    int64_t max0 = data[0], max1 = data[0];
+    size_t index = 0;
+    for (; index + 2 <= count; index += 2)
+    {
+        min0 = std::min(min0, data[index]);
+        max0 = std::max(max0, data[index]);
+        min1 = std::min(min1, data[index + 1]);
+        max1 = std::max(max1, data[index + 1]);
+    }
+    if (index < count)
+    {
+        min0 = std::min(min0, data[index]);
+        max0 = std::max(max0, data[index]);
+    }
+    const int64_t min = std::min(min0, min1);
+    const int64_t max = std::max(max0, max1);
+
+    const uint64_t umin = uint64_t(min);
+    const double range = Uint64ToDouble(uint64_t(max) - umin);
+    valuesdouble.resize(count);
+    double* out = valuesdouble.data();
+
+    // Uint64ToDouble two at a time
+    const __m128i minVector = _mm_set1_epi64x(int64_t(umin));
+    const __m128i twoTo52Bits = _mm_set1_epi64x(0x4330000000000000ll);
+    const __m128i lowMask = _mm_set1_epi64x(0xffffffffll);
+    const __m128d twoTo52 = _mm_set1_pd(4503599627370496.0);
+    const __m128d twoTo32 = _mm_set1_pd(4294967296.0);
+    const __m128d rangeVector = _mm_set1_pd(range);
+    for (index = 0; index + 2 <= count; index += 2)
+    {
+        __m128i difference = _mm_sub_epi64(_mm_loadu_si128((const __m128i*)&data[index]), minVector);
+        __m128d high = _mm_castsi128_pd(_mm_or_si128(_mm_srli_epi64(difference, 32), twoTo52Bits));
+        __m128d low = _mm_castsi128_pd(_mm_or_si128(_mm_and_si128(difference, lowMask), twoTo52Bits));
+        __m128d value = _mm_add_pd(_mm_mul_pd(_mm_sub_pd(high, twoTo52), twoTo32), _mm_sub_pd(low, twoTo52));
+        _mm_storeu_pd(&out[index], _mm_div_pd(value, rangeVector));
+    }
+    for (; index < count; ++index)
+        out[index] = Uint64ToDouble(uint64_t(data[index]) - umin) / range;
+}
+
+// Terms kept as ScaledDoubles. Everything is scaled down by the bigger exponent of the smallest and biggest
+// values, which puts them and their difference in the range of a double. Values too many orders of magnitude
+// below that come out as the smallest value, which is as close as a double gets anyway.
+inline void NormalizeValues(const std::vector<ScaledDouble>& values, std::vector<double>& valuesdouble, NormalizeMode mode = NormalizeMode::Linear)
+{
+    if (mode == NormalizeMode::LogMagnitude)
+    {
+        NormalizeLogMagnitude(values, valuesdouble);
+        return;
+    }
+
+    ScaledDouble min = values[0];
+    ScaledDouble max = values[0];
+    for (const ScaledDouble& value : values)
+    {
+        if (value < min)
+            min = value;
+        if (max < value)
+            max = value;
+    }
+
+    int64_t exponent = std::max(min.m_exponent, max.m_exponent);
+    double scaledMin = ScaledToDouble(min, exponent);
+    double range = ScaledToDouble(max, exponent) - scaledMin;
+    valuesdouble.resize(values.size());
+    for (size_t index = 0; index < values.size(); ++index)
+        valuesdouble[index] = (ScaledToDouble(values[index], exponent) - scaledMin) / range;
+}
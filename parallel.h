@@ -0,0 +1,117 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Returns the number of threads to spread work across. 0 means use every hardware thread.
+inline size_t GetNumThreads(size_t requested = 0)
+{
+    if (requested > 0)
+        return requested;
+    return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+}
+
+// Calls lambda(itemIndex) for every item in [0, numItems), spread across up to numThreads threads.
+// Each thread takes the next unclaimed item when it finishes one, so uneven items balance out.
+// The calling thread works too, and all items are done when this returns.
+template <typename LAMBDA>
+void ParallelFor(size_t numItems, size_t numThreads, const LAMBDA& lambda)
+{
+    std::atomic<size_t> nextItem(0);
+    auto worker = [&] ()
+    {
+        for (size_t item = nextItem++; item < numItems; item = nextItem++)
+            lambda(item);
+    };
+
+    numThreads = std::min(numThreads, numItems);
+    std::vector<std::thread> threads;
+    for (size_t index = 1; index < numThreads; ++index)
+        threads.emplace_back(worker);
+
+    worker();
+
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+// Runs jobs one at a time, in the order they were pushed, on a background thread, so the thread pushing them
+// can carry on with its own work. Jobs should own copies of whatever they use, since the caller's data may have
+// changed or gone by the time they run. The thread starts with the first job, and Flush() waits for every job
+// pushed so far to finish.
+class WorkQueue
+{
+public:
+    WorkQueue() = default;
+    WorkQueue(const WorkQueue&) = delete;
+    WorkQueue& operator = (const WorkQueue&) = delete;
+
+    ~WorkQueue()
+    {
+        Flush();
+        if (m_thread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_wake.notify_one();
+            m_thread.join();
+        }
+    }
+
+    void Push(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push_back(std::move(job));
+            if (!m_thread.joinable())
+                m_thread = std::thread([this] () { Run(); });
+        }
+        m_wake.notify_one();
+    }
+
+    void Flush()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_idle.wait(lock, [this] () { return m_jobs.empty() && !m_running; });
+    }
+
+private:
+    void Run()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_wake.wait(lock, [this] () { return m_stop || !m_jobs.empty(); });
+            if (m_jobs.empty())
+                return;
+
+            std::function<void()> job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            m_running = true;
+            lock.unlock();
+
+            job();
+
+            lock.lock();
+            m_running = false;
+            if (m_jobs.empty())
+                m_idle.notify_all();
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_idle;
+    std::deque<std::function<void()>> m_jobs;
+    std::thread m_thread;
+    bool m_running = false;
+    bool m_stop = false;
+};
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Each sieve segment is a bitset this big, sized to stay in L1 while every base prime crosses off its multiples
+static const size_t c_sieveSegmentBytes = 32 * 1024;
+
+// An upper bound on the nth prime (counting 2 as the 1st). Rosser's theorem, from the prime number theorem,
+// gives p_n < n * (ln n + ln ln n) for n >= 6.
+inline uint64_t NthPrimeUpperBound(uint64_t n)
+{
+    if (n < 6)
+        return 13;
+
+    double logN = log(double(n));
+    return uint64_t(double(n) * (logN + log(logN))) + 1;
+}
+
+// floor(sqrt(value)), corrected for the rounding of the double precision sqrt
+inline uint64_t ISqrt(uint64_t value)
+{
+    uint64_t root = uint64_t(sqrt(double(value)));
+    while (root > 0 && root * root > value)
+        root--;
+    while ((root + 1) * (root + 1) <= value)
+        root++;
+    return root;
+}
+
+// value must not be 0
+inline unsigned int CountTrailingZeros(uint64_t value)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return (unsigned int)index;
+#elif defined(_MSC_VER)
+    // 32 bit MSVC only scans 32 bits at a time
+    unsigned long index;
+    if (_BitScanForward(&index, uint32_t(value)))
+        return (unsigned int)index;
+    _BitScanForward(&index, uint32_t(value >> 32));
+    return (unsigned int)index + 32;
+#else
+    return (unsigned int)__builtin_ctzll(value);
+#endif
+}
+
+// the full 128 bit product of a and b, returning the low 64 bits and storing the high 64 bits in high
+inline uint64_t MultiplyFull(uint64_t a, uint64_t b, uint64_t& high)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    return _umul128(a, b, &high);
+#elif defined(_MSC_VER)
+    // 32 bit MSVC has neither, so it is done in 32 bit halves. The middle sum holds at most three 32 bit
+    // values, so it can't overflow.
+    uint64_t aLow = uint32_t(a), aHigh = a >> 32;
+    uint64_t bLow = uint32_t(b), bHigh = b >> 32;
+    uint64_t lowLow = aLow * bLow;
+    uint64_t lowHigh = aLow * bHigh;
+    uint64_t highLow = aHigh * bLow;
+    uint64_t middle = (lowLow >> 32) + uint32_t(lowHigh) + uint32_t(highLow);
+    high = aHigh * bHigh + (lowHigh >> 32) + (highLow >> 32) + (middle >> 32);
+    return (middle << 32) | uint32_t(lowLow);
+#else
+    unsigned __int128 product = (unsigned __int128)a * b;
+    high = uint64_t(product >> 64);
+    return uint64_t(product);
+#endif
+}
+
+// Arithmetic modulo an odd 64 bit modulus n in Montgomery form, where x is stored as x * 2^64 mod n. Every
+// product is a 128 bit multiply followed by a reduction that only needs multiplies and a subtract, instead of
+// a 128 bit by 64 bit division.
+struct Montgomery
+{
+    Montgomery(uint64_t n)
+        : m_modulus(n)
+    {
+        // n^-1 mod 2^64 by Newton's iteration, each step doubling the correct low bits. n * n = 1 mod 8 for
+        // odd n, so n itself starts with 3 and five steps give 96.
+        m_inverse = n;
+        for (int i = 0; i < 5; ++i)
+            m_inverse *= 2 - n * m_inverse;
+
+        // 2^64 mod n is the Montgomery form of 1, and doubling that 64 more times gives 2^128 mod n, which
+        // converts into Montgomery form with one multiply
+        m_one = (0 - n) % n;
+        m_r2 = m_one;
+        for (int i = 0; i < 64; ++i)
+            m_r2 = Add(m_r2, m_r2);
+    }
+
+    uint64_t Add(uint64_t a, uint64_t b) const
+    {
+        // a + b can carry out of 64 bits when n is above 2^63
+        uint64_t sum = a + b;
+        if (sum < a || sum >= m_modulus)
+            sum -= m_modulus;
+        return sum;
+    }
+
+    // a * b / 2^64 mod n. With m = low * n^-1 mod 2^64, m * n has the same low 64 bits as a * b, so
+    // a * b - m * n is an exact multiple of 2^64 and its high 64 bits are the result, off by at most n.
+    uint64_t Multiply(uint64_t a, uint64_t b) const
+    {
+        uint64_t high;
+        uint64_t low = MultiplyFull(a, b, high);
+        uint64_t mnHigh;
+        MultiplyFull(low * m_inverse, m_modulus, mnHigh);
+        uint64_t result = high - mnHigh;
+        if (high < mnHigh)
+            result += m_modulus;
+        return result;
+    }
+
+    uint64_t ToMontgomery(uint64_t value) const
+    {
+        return Multiply(value % m_modulus, m_r2);
+    }
+
+    uint64_t Power(uint64_t base, uint64_t exponent) const
+    {
+        uint64_t result = m_one;
+        while (exponent)
+        {
+            if (exponent & 1)
+                result = Multiply(result, base);
+            base = Multiply(base, base);
+            exponent >>= 1;
+        }
+        return result;
+    }
+
+    uint64_t m_modulus;
+    uint64_t m_inverse;
+    uint64_t m_one;
+    uint64_t m_r2;
+};
+
+// Deterministic Miller-Rabin. The 7 bases below (found by Jim Sinclair) have no strong pseudoprime in common
+// below 2^64, so the answer is exact for every int64. Small factors are trial divided first, which settles
+// most composites and every value below 67^2 without any modular exponentiation.
+inline bool IsPrime(int64_t signedValue)
+{
+    if (signedValue < 2)
+        return false;
+    uint64_t value = uint64_t(signedValue);
+
+    static const uint64_t c_smallPrimes[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61 };
+    for (uint64_t prime : c_smallPrimes)
+    {
+        if (value % prime == 0)
+            return value == prime;
+    }
+    if (value < 67 * 67)
+        return true;
+
+    // value - 1 = d * 2^s with d odd
+    uint64_t d = value - 1;
+    unsigned int s = CountTrailingZeros(d);
+    d >>= s;
+
+    Montgomery montgomery(value);
+    const uint64_t one = montgomery.m_one;
+    const uint64_t minusOne = value - one;
+
+    static const uint64_t c_bases[] = { 2, 325, 9375, 28178, 450775, 9780504, 1795265022 };
+    for (uint64_t base : c_bases)
+    {
+        // a base that is a multiple of value says nothing
+        uint64_t a = montgomery.ToMontgomery(base);
+        if (a == 0)
+            continue;
+
+        uint64_t x = montgomery.Power(a, d);
+        if (x == one || x == minusOne)
+            continue;
+
+        // value is a strong probable prime to this base only if squaring reaches -1 within s - 1 steps
+        bool probablePrime = false;
+        for (unsigned int i = 1; i < s && !probablePrime; ++i)
+        {
+            x = montgomery.Multiply(x, x);
+            probablePrime = (x == minusOne);
+        }
+        if (!probablePrime)
+            return false;
+    }
+    return true;
+}
+
+// Calls callback(prime) for every prime below limit, in increasing order, until it returns false.
+// This is a segmented sieve of Eratosthenes over odd numbers only. The odd primes up to sqrt(limit) are sieved
+// up front, then the range is walked in segments of c_sieveSegmentBytes, one bit per odd number, in which each
+// of those primes crosses off its odd multiples. Each prime remembers where its next multiple is, so the
+// segments only need memory for themselves and the base primes, whatever the limit.
+template <typename LAMBDA>
+void ForEachPrime(uint64_t limit, const LAMBDA& callback)
+{
+    if (limit <= 2 || !callback(uint64_t(2)))
+        return;
+
+    // the odd base primes, bit i of the small sieve standing for 2i+1
+    uint64_t sqrtLimit = ISqrt(limit);
+    std::vector<uint8_t> smallSieve(sqrtLimit / 2 + 1, 1);
+    std::vector<uint64_t> basePrimes;
+    std::vector<uint64_t> nextMultiples;
+    for (uint64_t index = 1; 2 * index + 1 <= sqrtLimit; ++index)
+    {
+        if (!smallSieve[index])
+            continue;
+
+        uint64_t prime = 2 * index + 1;
+        basePrimes.push_back(prime);
+        nextMultiples.push_back(prime * prime);
+        for (uint64_t multiple = prime * prime; multiple <= sqrtLimit; multiple += 2 * prime)
+            smallSieve[multiple / 2] = 0;
+    }
+
+    // bit i of a segment starting at the odd number low stands for low + 2i
+    const uint64_t segmentBits = c_sieveSegmentBytes * 8;
+    std::vector<uint64_t> segment(segmentBits / 64);
+    for (uint64_t low = 1; low < limit; low += 2 * segmentBits)
+    {
+        uint64_t high = std::min(low + 2 * segmentBits, limit);
+        std::fill(segment.begin(), segment.end(), ~uint64_t(0));
+
+        // cross off the odd multiples of every base prime, starting from its square
+        for (size_t primeIndex = 0; primeIndex < basePrimes.size(); ++primeIndex)
+        {
+            uint64_t step = 2 * basePrimes[primeIndex];
+            uint64_t multiple = nextMultiples[primeIndex];
+            for (; multiple < high; multiple += step)
+            {
+                uint64_t bit = (multiple - low) / 2;
+                segment[bit / 64] &= ~(uint64_t(1) << (bit % 64));
+            }
+            nextMultiples[primeIndex] = multiple;
+        }
+
+        // 1 isn't prime
+        if (low == 1)
+            segment[0] &= ~uint64_t(1);
+
+        // report what's left, skipping the bits past the limit in the last segment
+        uint64_t numBits = (high - low + 1) / 2;
+        for (uint64_t wordIndex = 0; wordIndex * 64 < numBits; ++wordIndex)
+        {
+            uint64_t word = segment[wordIndex];
+            if (numBits - wordIndex * 64 < 64)
+                word &= (uint64_t(1) << (numBits - wordIndex * 64)) - 1;
+
+            while (word)
+            {
+                uint64_t bit = wordIndex * 64 + CountTrailingZeros(word);
+                if (!callback(low + 2 * bit))
+                    return;
+                word &= word - 1;
+            }
+        }
+    }
+}
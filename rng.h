@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+#include <random>
+#include <stdint.h>
+
+// The generators a trial can draw its random numbers from. Each one is keyed by a 64 bit key (the test index)
+// and a 64 bit stream, so every (key, stream) pair gets its own independent sequence which can be reproduced
+// on any thread without generating anything before it. They all produce 32 bit values like std::mt19937, so
+// the same distributions and bit slicing work with any of them.
+//
+// The counter based generators (Philox and SplitMix64) hash a counter into each output, so creating one is a
+// handful of register writes. Seeding a std::mt19937 means running the seed sequence over 624 words of state
+// and then regenerating all of them before the first draw, which costs far more than the 3 draws a 90 value
+// RandomFibonacci trial needs.
+
+#define RNG_PHILOX 0
+#define RNG_SPLITMIX 1
+#define RNG_MT19937 2
+
+// A std::seed_seq of N seeds which keeps them inline rather than in a heap allocated vector. generate() is the
+// algorithm the standard specifies for std::seed_seq::generate, so an engine seeded with this starts in the
+// same state as one seeded with a std::seed_seq of the same seeds.
+template <size_t N>
+struct FixedSeedSeq
+{
+    typedef uint32_t result_type;
+
+    uint32_t m_seeds[N];
+
+    template <typename ITERATOR>
+    void generate(ITERATOR begin, ITERATOR end) const
+    {
+        size_t n = size_t(end - begin);
+        if (n == 0)
+            return;
+
+        for (ITERATOR it = begin; it != end; ++it)
+            *it = 0x8b8b8b8b;
+
+        size_t t = (n >= 623) ? 11 : (n >= 68) ? 7 : (n >= 39) ? 5 : (n >= 7) ? 3 : (n - 1) / 2;
+        size_t p = (n - t) / 2;
+        size_t q = p + t;
+        size_t m = std::max(N + 1, n);
+
+        auto T = [] (uint32_t x) { return x ^ (x >> 27); };
+
+        for (size_t k = 0; k < m; ++k)
+        {
+            uint32_t r1 = 1664525u * T(uint32_t(begin[k % n] ^ begin[(k + p) % n] ^ begin[(k + n - 1) % n]));
+            uint32_t r2 = r1 + ((k == 0) ? uint32_t(N) : (k <= N) ? uint32_t(k % n) + m_seeds[k - 1] : uint32_t(k % n));
+            begin[(k + p) % n] = uint32_t(begin[(k + p) % n] + r1);
+            begin[(k + q) % n] = uint32_t(begin[(k + q) % n] + r2);
+            begin[k % n] = r2;
+        }
+
+        for (size_t k = m; k < m + n; ++k)
+        {
+            uint32_t r3 = 1566083941u * T(uint32_t(begin[k % n] + begin[(k + p) % n] + begin[(k + n - 1) % n]));
+            uint32_t r4 = r3 - uint32_t(k % n);
+            begin[(k + p) % n] = uint32_t(begin[(k + p) % n] ^ r3);
+            begin[(k + q) % n] = uint32_t(begin[(k + q) % n] ^ r4);
+            begin[k % n] = r4;
+        }
+    }
+};
+
+// Philox4x32-10 from Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3". Ten rounds of multiplies
+// and xors turn a 128 bit counter and a 64 bit key into 4 outputs. The key is the key given here, the counter
+// is the stream in its top 64 bits and the block number in its bottom 64 bits.
+class PhiloxRNG
+{
+public:
+    typedef uint32_t result_type;
+
+    static const char* Name() { return "philox4x32-10"; }
+
+    PhiloxRNG(uint64_t key, uint64_t stream)
+        : m_key{ uint32_t(key), uint32_t(key >> 32) }
+        , m_counter{ 0, 0, uint32_t(stream), uint32_t(stream >> 32) }
+        , m_used(4)
+    {
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return 0xffffffff; }
+
+    result_type operator()()
+    {
+        if (m_used == 4)
+            NextBlock();
+        return m_block[m_used++];
+    }
+
+    // Philox4x32-10 of one counter and key, for checking against the published known answers
+    static void Block(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4])
+    {
+        uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+        uint32_t k0 = key[0], k1 = key[1];
+        for (int round = 0; round < 10; ++round)
+        {
+            uint64_t product0 = uint64_t(0xD2511F53) * c0;
+            uint64_t product1 = uint64_t(0xCD9E8D57) * c2;
+            c0 = uint32_t(product1 >> 32) ^ c1 ^ k0;
+            c1 = uint32_t(product1);
+            c2 = uint32_t(product0 >> 32) ^ c3 ^ k1;
+            c3 = uint32_t(product0);
+            k0 += 0x9E3779B9;
+            k1 += 0xBB67AE85;
+        }
+        out[0] = c0;
+        out[1] = c1;
+        out[2] = c2;
+        out[3] = c3;
+    }
+
+private:
+    void NextBlock()
+    {
+        Block(m_counter, m_key, m_block);
+        if (++m_counter[0] == 0)
+            ++m_counter[1];
+        m_used = 0;
+    }
+
+    uint32_t m_key[2];
+    uint32_t m_counter[4];
+    uint32_t m_block[4];
+    uint32_t m_used;
+};
+
+// SplitMix64 (Steele, Lea and Flood, "Fast Splittable Pseudorandom Number Generators"). Output n is a 64 bit
+// finalizer applied to start + n * gamma, where start hashes the key and stream together. Each 64 bit output
+// is handed out as two 32 bit values, low half first.
+class SplitMixRNG
+{
+public:
+    typedef uint32_t result_type;
+
+    static const char* Name() { return "splitmix64"; }
+
+    SplitMixRNG(uint64_t key, uint64_t stream)
+        : m_state(Mix(key ^ Mix(stream + c_gamma)))
+        , m_high(0)
+        , m_hasHigh(false)
+    {
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return 0xffffffff; }
+
+    result_type operator()()
+    {
+        if (m_hasHigh)
+        {
+            m_hasHigh = false;
+            return m_high;
+        }
+
+        m_state += c_gamma;
+        uint64_t value = Mix(m_state);
+        m_high = uint32_t(value >> 32);
+        m_hasHigh = true;
+        return uint32_t(value);
+    }
+
+    static uint64_t Mix(uint64_t z)
+    {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+private:
+    static const uint64_t c_gamma = 0x9e3779b97f4a7c15ull;
+
+    uint64_t m_state;
+    uint32_t m_high;
+    bool m_hasHigh;
+};
+
+// The original generator, std::mt19937 seeded through a seed sequence of the key and 8 fixed words. Stream 0
+// gives exactly the sequences this program has always used, other streams change the fixed words.
+class MersenneTwisterRNG : public std::mt19937
+{
+public:
+    static const char* Name() { return "mt19937"; }
+
+    MersenneTwisterRNG(uint64_t key, uint64_t stream)
+        : std::mt19937(Seeded(key, stream))
+    {
+    }
+
+private:
+    static std::mt19937 Seeded(uint64_t key, uint64_t stream)
+    {
+        const FixedSeedSeq<9> seq = { { uint32_t(key), 0x65cd8674u ^ uint32_t(stream), 0x7952426cu ^ uint32_t(stream >> 32),
+            0x2a816f2cu, 0x689dbc5fu ^ uint32_t(key >> 32), 0xe138d1e5u, 0x91da7241u, 0x57f2d0e0u, 0xed41c211u } };
+        return std::mt19937(seq);
+    }
+};
+
+// 64 random bits from two 32 bit draws, the first in the low half so the bits come out in the order they were
+// generated when read from bit 0 up
+template <typename RNG>
+uint64_t RandomBits64(RNG& rng)
+{
+    uint64_t low = rng();
+    return low | (uint64_t(rng()) << 32);
+}
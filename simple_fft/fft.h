@@ -85,6 +85,40 @@ bool FFT(const TRealArray3D & data_in, TComplexArray3D & data_out,
          const size_t size1, const size_t size2, const size_t size3,
          const char *& error_description);
 
+// not-in-place, real, forward, half spectrum: data_out receives only the
+// size/2+1 unique bins of the spectrum of a real signal, the others being
+// their complex conjugates
+template <class TRealArray1D, class TComplexArray1D>
+bool RFFT(const TRealArray1D & data_in, TComplexArray1D & data_out,
+          const size_t size, const char *& error_description);
+
+// Batched transforms of batch_size signals of the same size at once, stored as
+// separate planes of real and imaginary parts with element n of signal b at
+// index n * batch_size + b. The batch index being innermost, every butterfly
+// processes all signals in one contiguous run.
+
+// in-place, complex, forward, batched
+inline bool FFTBatch(real_type * real, real_type * imag, const size_t size,
+                     const size_t batch_size, const char *& error_description);
+
+// in-place, complex, inverse, batched
+inline bool IFFTBatch(real_type * real, real_type * imag, const size_t size,
+                      const size_t batch_size, const char *& error_description);
+
+// not-in-place, real, forward, half spectrum, batched: data_in holds size real
+// samples per signal, out_real and out_imag receive (size/2+1) * batch_size values
+inline bool RFFTBatch(const real_type * data_in, real_type * out_real, real_type * out_imag,
+                      const size_t size, const size_t batch_size,
+                      const char *& error_description);
+
+/// Transform engine selection
+
+// selects the engine used by every 1D transform from now on, in all threads;
+// 2D and 3D transforms use it for their 1D passes as well
+inline void SetAlgorithm(const FFT_algorithm algorithm);
+
+inline FFT_algorithm GetAlgorithm();
+
 // NOTE: There is no inverse transform from complex spectrum to real signal
 // because round-off errors during computation of inverse FFT lead to the appearance
 // of signal imaginary components even though they are small by absolute value.
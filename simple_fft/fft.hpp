@@ -2,6 +2,7 @@
 #define __SIMPLE_FFT__FFT_HPP__
 
 #include "copy_array.hpp"
+#include "fft_batch.hpp"
 #include "fft_impl.hpp"
 
 namespace simple_fft {
@@ -150,6 +151,49 @@ bool FFT(const TRealArray3D & data_in, TComplexArray3D & data_out,
                                                       error_description);
 }
 
+// not-in-place, real, forward, half spectrum
+template <class TRealArray1D, class TComplexArray1D>
+bool RFFT(const TRealArray1D & data_in, TComplexArray1D & data_out,
+          const size_t size, const char *& error_description)
+{
+    return impl::makeRealTransform(data_in, data_out, size, error_description);
+}
+
+// in-place, complex, forward, batched
+inline bool FFTBatch(real_type * real, real_type * imag, const size_t size,
+                     const size_t batch_size, const char *& error_description)
+{
+    return impl::batchFFTInplace(real, imag, size, batch_size, impl::FFT_FORWARD,
+                                 error_description);
+}
+
+// in-place, complex, inverse, batched
+inline bool IFFTBatch(real_type * real, real_type * imag, const size_t size,
+                      const size_t batch_size, const char *& error_description)
+{
+    return impl::batchFFTInplace(real, imag, size, batch_size, impl::FFT_BACKWARD,
+                                 error_description);
+}
+
+// not-in-place, real, forward, half spectrum, batched
+inline bool RFFTBatch(const real_type * data_in, real_type * out_real, real_type * out_imag,
+                      const size_t size, const size_t batch_size,
+                      const char *& error_description)
+{
+    return impl::batchRealFFT(data_in, out_real, out_imag, size, batch_size,
+                              error_description);
+}
+
+inline void SetAlgorithm(const FFT_algorithm algorithm)
+{
+    impl::algorithmSetting().store(int(algorithm), std::memory_order_relaxed);
+}
+
+inline FFT_algorithm GetAlgorithm()
+{
+    return impl::getAlgorithm();
+}
+
 } // simple_fft
 
 #endif // __SIMPLE_FFT__FFT_HPP__
@@ -0,0 +1,251 @@
+#ifndef __SIMPLE_FFT__FFT_BATCH_HPP__
+#define __SIMPLE_FFT__FFT_BATCH_HPP__
+
+#include "fft_settings.h"
+#include "error_handling.hpp"
+#include "fft_impl.hpp"
+#include "fft_plan.hpp"
+#include "fft_simd.hpp"
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+using std::size_t;
+
+// Batched 1D FFT of many signals of the same size at once. The signals are stored
+// as structure of arrays: separate planes of real and imaginary parts, in which
+// element n of signal b lives at index n * batch_size + b. Every butterfly then
+// runs over batch_size contiguous values with the same twiddle, which turns the
+// innermost loop into straight line code that vectorizes across signals.
+
+namespace simple_fft {
+namespace impl {
+
+inline void rearrangeBatchData(real_type * real, real_type * imag, const size_t batch_size,
+                               const FFTPlan & plan)
+{
+    for (size_t i = 0; i < plan.num_elements; ++i)
+    {
+        size_t target_index = bitReversedIndex(plan, i);
+        if (target_index > i)
+        {
+            real_type * real_a = real + i * batch_size;
+            real_type * imag_a = imag + i * batch_size;
+            real_type * real_b = real + target_index * batch_size;
+            real_type * imag_b = imag + target_index * batch_size;
+            for (size_t b = 0; b < batch_size; ++b)
+            {
+                real_type buf = real_a[b];
+                real_a[b] = real_b[b];
+                real_b[b] = buf;
+
+                buf = imag_a[b];
+                imag_a[b] = imag_b[b];
+                imag_b[b] = buf;
+            }
+        }
+    }
+}
+
+// one radix-2 butterfly applied to batch_size signals: a += w*b, b = a - w*b
+inline void batchButterfly(real_type * __restrict real_a, real_type * __restrict imag_a,
+                           real_type * __restrict real_b, real_type * __restrict imag_b,
+                           const real_type factor_real, const real_type factor_imag,
+                           const size_t batch_size)
+{
+    for (size_t b = 0; b < batch_size; ++b)
+    {
+        real_type product_real = factor_real * real_b[b] - factor_imag * imag_b[b];
+        real_type product_imag = factor_real * imag_b[b] + factor_imag * real_b[b];
+        real_b[b] = real_a[b] - product_real;
+        imag_b[b] = imag_a[b] - product_imag;
+        real_a[b] += product_real;
+        imag_a[b] += product_imag;
+    }
+}
+
+inline void makeBatchTransform(real_type * real, real_type * imag, const size_t batch_size,
+                               const FFTPlan & plan)
+{
+    const size_t num_elements = plan.num_elements;
+    const complex_type * stage_twiddles = plan.stage_twiddles.data();
+
+    // double based data goes through the butterfly kernels picked for this CPU
+    if (std::is_same<real_type, double>::value &&
+        std::is_same<complex_type, std::complex<double> >::value)
+    {
+        const simd::StageKernels & kernels = simd::getStageKernels();
+        for (size_t i = 1; i < num_elements; i <<= 1)
+        {
+            kernels.split_stage(reinterpret_cast<double *>(real), reinterpret_cast<double *>(imag),
+                                num_elements, i,
+                                reinterpret_cast<const double *>(stage_twiddles + i - 1),
+                                batch_size);
+        }
+        return;
+    }
+
+    for (size_t i = 1; i < num_elements; i <<= 1)
+    {
+        const complex_type * twiddles = stage_twiddles + i - 1;
+
+        // walk each group of pairs in memory order, so both halves stream through the cache
+        for (size_t group = 0; group < num_elements; group += 2 * i)
+        {
+            for (size_t j = 0; j < i; ++j)
+            {
+                const size_t k = group + j;
+                const size_t match = k + i;
+                batchButterfly(real + k * batch_size, imag + k * batch_size,
+                               real + match * batch_size, imag + match * batch_size,
+                               twiddles[j].real(), twiddles[j].imag(), batch_size);
+            }
+        }
+    }
+}
+
+inline bool batchFFTInplace(real_type * real, real_type * imag, const size_t size,
+                            const size_t batch_size, const FFT_direction fft_direction,
+                            const char *& error_description)
+{
+    if(!checkNumElements(size, error_description)) {
+        return false;
+    }
+
+    const FFTPlan * plan = getPlan(size, fft_direction, error_description);
+    if(!plan) {
+        return false;
+    }
+
+    if (plan->power_of_two) {
+        rearrangeBatchData(real, imag, batch_size, *plan);
+        makeBatchTransform(real, imag, batch_size, *plan);
+    }
+    else {
+        // the other sizes have no batched butterflies, transform signal by signal
+        thread_local std::vector<complex_type> signal;
+        signal.resize(size);
+        const FFT_algorithm algorithm = getAlgorithm();
+        for (size_t b = 0; b < batch_size; ++b)
+        {
+            for (size_t n = 0; n < size; ++n)
+                signal[n] = complex_type(real[n * batch_size + b], imag[n * batch_size + b]);
+
+            transformContiguous(signal.data(), *plan, algorithm);
+
+            for (size_t n = 0; n < size; ++n) {
+                real[n * batch_size + b] = signal[n].real();
+                imag[n * batch_size + b] = signal[n].imag();
+            }
+        }
+    }
+
+    if (FFT_BACKWARD == fft_direction) {
+        const real_type mult = 1.0 / size;
+        for (size_t i = 0, count = size * batch_size; i < count; ++i) {
+            real[i] *= mult;
+            imag[i] *= mult;
+        }
+    }
+
+    return true;
+}
+
+// Batched real-input forward FFT producing the size/2+1 unique bins of each
+// signal, packing pairs of samples into complex values like makeRealTransform.
+// data_in holds element n of signal b at n * batch_size + b, and so do
+// out_real and out_imag, which need (size/2+1) * batch_size elements each.
+inline bool batchRealFFT(const real_type * data_in, real_type * out_real, real_type * out_imag,
+                         const size_t size, const size_t batch_size,
+                         const char *& error_description)
+{
+    if(!checkNumElements(size, error_description)) {
+        return false;
+    }
+
+    // a single sample has nothing to pack
+    if (size < 2) {
+        for (size_t b = 0; b < batch_size; ++b) {
+            out_real[b] = data_in[b];
+            out_imag[b] = 0.0;
+        }
+        return true;
+    }
+
+    thread_local std::vector<real_type> packed_real, packed_imag;
+
+    // odd sizes cannot be packed, run a full complex transform instead
+    if (size % 2 != 0) {
+        packed_real.assign(data_in, data_in + size * batch_size);
+        packed_imag.assign(size * batch_size, 0.0);
+        if(!batchFFTInplace(packed_real.data(), packed_imag.data(), size, batch_size,
+                            FFT_FORWARD, error_description))
+        {
+            return false;
+        }
+
+        const size_t count = (size / 2 + 1) * batch_size;
+        for (size_t i = 0; i < count; ++i) {
+            out_real[i] = packed_real[i];
+            out_imag[i] = packed_imag[i];
+        }
+        return true;
+    }
+
+    const size_t half = size / 2;
+    packed_real.resize(half * batch_size);
+    packed_imag.resize(half * batch_size);
+    for (size_t n = 0; n < half; ++n)
+    {
+        const real_type * even = data_in + (2 * n) * batch_size;
+        const real_type * odd = even + batch_size;
+        for (size_t b = 0; b < batch_size; ++b) {
+            packed_real[n * batch_size + b] = even[b];
+            packed_imag[n * batch_size + b] = odd[b];
+        }
+    }
+
+    if(!batchFFTInplace(packed_real.data(), packed_imag.data(), half, batch_size,
+                        FFT_FORWARD, error_description))
+    {
+        return false;
+    }
+
+    const FFTPlan * plan = getPlan(size, FFT_FORWARD, error_description);
+    if(!plan) {
+        return false;
+    }
+
+    // X[k] = E[k] + w^k * O[k] with E[k] = (Z[k] + conj(Z[half-k])) / 2 and
+    // O[k] = -i * (Z[k] - conj(Z[half-k])) / 2, as in makeRealTransform
+    for (size_t k = 0; k <= half; ++k)
+    {
+        const real_type * z_real = packed_real.data() + ((k == half) ? 0 : k) * batch_size;
+        const real_type * z_imag = packed_imag.data() + ((k == half) ? 0 : k) * batch_size;
+        const real_type * mirror_real = packed_real.data() + ((k == 0) ? 0 : half - k) * batch_size;
+        const real_type * mirror_imag = packed_imag.data() + ((k == 0) ? 0 : half - k) * batch_size;
+        const complex_type factor = (k == half) ? complex_type(-1.0, 0.0) : plan->twiddles[k];
+        const real_type factor_real = factor.real();
+        const real_type factor_imag = factor.imag();
+
+        real_type * dest_real = out_real + k * batch_size;
+        real_type * dest_imag = out_imag + k * batch_size;
+        for (size_t b = 0; b < batch_size; ++b)
+        {
+            const real_type even_real = 0.5 * (z_real[b] + mirror_real[b]);
+            const real_type even_imag = 0.5 * (z_imag[b] - mirror_imag[b]);
+            const real_type odd_real = 0.5 * (z_imag[b] + mirror_imag[b]);
+            const real_type odd_imag = -0.5 * (z_real[b] - mirror_real[b]);
+
+            dest_real[b] = even_real + factor_real * odd_real - factor_imag * odd_imag;
+            dest_imag[b] = even_imag + factor_real * odd_imag + factor_imag * odd_real;
+        }
+    }
+
+    return true;
+}
+
+} // namespace impl
+} // namespace simple_fft
+
+#endif // __SIMPLE_FFT__FFT_BATCH_HPP__
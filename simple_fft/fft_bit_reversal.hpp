@@ -0,0 +1,95 @@
+#ifndef __SIMPLE_FFT__FFT_BIT_REVERSAL_HPP__
+#define __SIMPLE_FFT__FFT_BIT_REVERSAL_HPP__
+
+#include "fft_settings.h"
+#include "fft_plan.hpp"
+#include <cstddef>
+#include <vector>
+
+using std::size_t;
+
+// Bit reversal permutation of contiguous complex data.
+//
+// Small sizes swap element pairs through the plan's table. Past L2 every swap
+// touches two unrelated cache lines, half the time far apart, so large sizes
+// use a blocked permutation in the spirit of COBRA (Carter & Gatlin, "Towards
+// an optimal bit-reversal permutation program"): writing an index as its top
+// bits a, middle bits m and bottom bits c, each b = c_bitReversalBlockBits wide
+// except m, the element at (a, m, c) goes to (rev(c), rev(m), rev(a)). For a
+// fixed m the 2^b x 2^b elements with every a and c form 2^b contiguous rows in
+// the source and 2^b contiguous rows in the destination, so they are gathered
+// into a small tile row by row and scattered out of it row by row. Every cache
+// line is then read once and written once.
+
+namespace simple_fft {
+namespace impl {
+
+// Out-of-place blocked permutation, dst[rev(i)] = src[i]; src and dst must not
+// overlap and the plan must use the blocked bit reversal
+inline void blockedBitReverse(const complex_type * src, complex_type * dst, const FFTPlan & plan)
+{
+    const size_t block_bits = c_bitReversalBlockBits;
+    const size_t block_size = size_t(1) << block_bits;
+    const size_t top_shift = plan.num_bits - block_bits;
+    const size_t * block_reversed = plan.block_reversed.data();
+    const size_t * middle_reversed = plan.middle_reversed.data();
+    const size_t num_middles = plan.middle_reversed.size();
+
+    thread_local std::vector<complex_type> tile;
+    tile.resize(block_size * block_size);
+    complex_type * tile_data = tile.data();
+
+    for (size_t middle = 0; middle < num_middles; ++middle)
+    {
+        // row a of the source lands in tile row rev(a)
+        for (size_t top = 0; top < block_size; ++top)
+        {
+            const complex_type * row = src + ((top << top_shift) | (middle << block_bits));
+            complex_type * tile_row = tile_data + block_reversed[top] * block_size;
+            for (size_t bottom = 0; bottom < block_size; ++bottom)
+                tile_row[bottom] = row[bottom];
+        }
+
+        // destination row rev(c) takes tile column c
+        const size_t reversed_middle = middle_reversed[middle] << block_bits;
+        for (size_t bottom = 0; bottom < block_size; ++bottom)
+        {
+            complex_type * row = dst + ((block_reversed[bottom] << top_shift) | reversed_middle);
+            for (size_t top = 0; top < block_size; ++top)
+                row[top] = tile_data[top * block_size + bottom];
+        }
+    }
+}
+
+// In-place permutation for any size, going through a per-thread scratch
+// buffer for the blocked one
+inline void bitReverse(complex_type * data, const FFTPlan & plan)
+{
+    const size_t num_elements = plan.num_elements;
+    if (usesBlockedBitReversal(plan))
+    {
+        thread_local std::vector<complex_type> scratch;
+        scratch.resize(num_elements);
+        blockedBitReverse(data, scratch.data(), plan);
+        for (size_t i = 0; i < num_elements; ++i)
+            data[i] = scratch[i];
+        return;
+    }
+
+    const size_t * bit_reversed = plan.bit_reversed.data();
+    for (size_t i = 0; i < num_elements; ++i)
+    {
+        const size_t target_index = bit_reversed[i];
+        if (target_index > i)
+        {
+            const complex_type buf = data[i];
+            data[i] = data[target_index];
+            data[target_index] = buf;
+        }
+    }
+}
+
+} // namespace impl
+} // namespace simple_fft
+
+#endif // __SIMPLE_FFT__FFT_BIT_REVERSAL_HPP__
@@ -0,0 +1,263 @@
+#ifndef __SIMPLE_FFT__FFT_ENGINES_HPP__
+#define __SIMPLE_FFT__FFT_ENGINES_HPP__
+
+#include "fft_settings.h"
+#include "fft_bit_reversal.hpp"
+#include "fft_plan.hpp"
+#include "fft_simd.hpp"
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+using std::size_t;
+
+// 1D transform engines working on contiguous complex data, selected with
+// simple_fft::SetAlgorithm():
+//  - FFT_RADIX2: bit reversal followed by log2(N) radix-2 passes, through the
+//    vectorized stage kernels of fft_simd.hpp.
+//  - FFT_RADIX4: bit reversal, then a radix-8 leaf pass doing the first three
+//    stages of every block of 8, then pairs of radix-2 stages fused into single
+//    radix-4 passes through the kernels of fft_simd.hpp. A 2048 point transform takes 5 passes over memory instead
+//    of 11.
+//  - FFT_STOCKHAM: Stockham autosort, radix-2 passes ping-ponging between the
+//    data and a scratch buffer in a way that leaves the output in natural
+//    order, so there is no bit reversal pass at all.
+// The engines other than FFT_RADIX2 need complex_type to be std::complex<double>
+// and fall back to FFT_RADIX2 otherwise.
+
+namespace simple_fft {
+namespace impl {
+
+inline std::atomic<int> & algorithmSetting()
+{
+    static std::atomic<int> algorithm(int(__SIMPLE_FFT_DEFAULT_ALGORITHM));
+    return algorithm;
+}
+
+inline FFT_algorithm getAlgorithm()
+{
+    return FFT_algorithm(algorithmSetting().load(std::memory_order_relaxed));
+}
+
+namespace engines {
+
+// plain complex arithmetic on doubles, without the NaN and infinity recovery
+// of std::complex multiplication
+struct Complex
+{
+    double re, im;
+};
+
+inline Complex operator + (const Complex & a, const Complex & b)
+{
+    Complex ret = { a.re + b.re, a.im + b.im };
+    return ret;
+}
+
+inline Complex operator - (const Complex & a, const Complex & b)
+{
+    Complex ret = { a.re - b.re, a.im - b.im };
+    return ret;
+}
+
+inline Complex operator * (const Complex & a, const Complex & b)
+{
+    Complex ret = { a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re };
+    return ret;
+}
+
+inline void radix2Passes(complex_type * data, const FFTPlan & plan, size_t first_half)
+{
+    const size_t num_elements = plan.num_elements;
+    const complex_type * stage_twiddles = plan.stage_twiddles.data();
+
+    if (std::is_same<complex_type, std::complex<double> >::value)
+    {
+        const simd::StageKernels & kernels = simd::getStageKernels();
+        for (size_t i = first_half; i < num_elements; i <<= 1)
+        {
+            kernels.interleaved_stage(reinterpret_cast<double *>(data), num_elements, i,
+                                      reinterpret_cast<const double *>(stage_twiddles + i - 1));
+        }
+        return;
+    }
+
+    complex_type product;
+    for (size_t i = first_half; i < num_elements; i <<= 1)
+    {
+        const complex_type * twiddles = stage_twiddles + i - 1;
+        for (size_t group = 0; group < num_elements; group += 2 * i)
+        {
+            for (size_t j = 0; j < i; ++j)
+            {
+                product = data[group + j + i] * twiddles[j];
+                data[group + j + i] = data[group + j] - product;
+                data[group + j] += product;
+            }
+        }
+    }
+}
+
+inline void radix2Transform(complex_type * data, const FFTPlan & plan)
+{
+    bitReverse(data, plan);
+    radix2Passes(data, plan, 1);
+}
+
+// The first three radix-2 stages on every block of 8 bit reversed elements,
+// done in registers with the 7 twiddles those stages use. Each block is read
+// completely before being written, so src and dst may be the same.
+inline void radix8Leaves(const Complex * src, Complex * dst, const size_t num_elements,
+                         const Complex * stage_twiddles)
+{
+    // stage_twiddles[0] is 1, [1..2] belong to the half = 2 stage, [3..6] to half = 4
+    const Complex w2 = stage_twiddles[2];
+    const Complex w41 = stage_twiddles[4];
+    const Complex w42 = stage_twiddles[5];
+    const Complex w43 = stage_twiddles[6];
+
+    for (size_t block = 0; block < num_elements; block += 8)
+    {
+        const Complex * x = src + block;
+        Complex * y = dst + block;
+
+        // half = 1, twiddle 1
+        const Complex a0 = x[0] + x[1], a1 = x[0] - x[1];
+        const Complex a2 = x[2] + x[3], a3 = x[2] - x[3];
+        const Complex a4 = x[4] + x[5], a5 = x[4] - x[5];
+        const Complex a6 = x[6] + x[7], a7 = x[6] - x[7];
+
+        // half = 2, twiddles 1 and w2
+        const Complex t3 = w2 * a3, t7 = w2 * a7;
+        const Complex b0 = a0 + a2, b2 = a0 - a2;
+        const Complex b1 = a1 + t3, b3 = a1 - t3;
+        const Complex b4 = a4 + a6, b6 = a4 - a6;
+        const Complex b5 = a5 + t7, b7 = a5 - t7;
+
+        // half = 4, twiddles 1, w41, w42 and w43
+        const Complex t5 = w41 * b5, t6 = w42 * b6, t7b = w43 * b7;
+        y[0] = b0 + b4;
+        y[4] = b0 - b4;
+        y[1] = b1 + t5;
+        y[5] = b1 - t5;
+        y[2] = b2 + t6;
+        y[6] = b2 - t6;
+        y[3] = b3 + t7b;
+        y[7] = b3 - t7b;
+    }
+}
+
+inline void radix4Transform(complex_type * data, const FFTPlan & plan)
+{
+    const size_t num_elements = plan.num_elements;
+    if (num_elements < 8 || !std::is_same<complex_type, std::complex<double> >::value)
+    {
+        radix2Transform(data, plan);
+        return;
+    }
+
+    Complex * complex_data = reinterpret_cast<Complex *>(data);
+    const Complex * stage_twiddles = reinterpret_cast<const Complex *>(plan.stage_twiddles.data());
+
+    // the blocked bit reversal is out of place anyway, so the leaves bring
+    // the data back from its scratch buffer
+    if (usesBlockedBitReversal(plan))
+    {
+        thread_local std::vector<complex_type> scratch;
+        scratch.resize(num_elements);
+        blockedBitReverse(data, scratch.data(), plan);
+        radix8Leaves(reinterpret_cast<const Complex *>(scratch.data()), complex_data,
+                     num_elements, stage_twiddles);
+    }
+    else
+    {
+        bitReverse(data, plan);
+        radix8Leaves(complex_data, complex_data, num_elements, stage_twiddles);
+    }
+
+    // fuse the remaining stages in pairs, with one radix-2 stage left over
+    // when their count is odd
+    const simd::StageKernels & kernels = simd::getStageKernels();
+    const double * twiddles = reinterpret_cast<const double *>(plan.stage_twiddles.data());
+    size_t half = 8;
+    for (; 4 * half <= num_elements; half <<= 2)
+    {
+        kernels.radix4_pass(reinterpret_cast<double *>(data), num_elements, half,
+                            twiddles + 2 * (half - 1), twiddles + 2 * (2 * half - 1));
+    }
+
+    if (half < num_elements)
+        radix2Passes(data, plan, half);
+}
+
+inline void stockhamTransform(complex_type * data, const FFTPlan & plan)
+{
+    const size_t num_elements = plan.num_elements;
+    if (!std::is_same<complex_type, std::complex<double> >::value)
+    {
+        radix2Transform(data, plan);
+        return;
+    }
+
+    thread_local std::vector<complex_type> scratch;
+    scratch.resize(num_elements);
+
+    const Complex * twiddles = reinterpret_cast<const Complex *>(plan.twiddles.data());
+    Complex * x = reinterpret_cast<Complex *>(data);
+    Complex * y = reinterpret_cast<Complex *>(scratch.data());
+
+    // Each pass splits every length n subsequence (interleaved with stride s)
+    // into its even and odd frequencies, writing them where the next pass
+    // expects them. exp(+-2*pi*i*p/n) is twiddles[p * s] since n * s = N.
+    for (size_t n = num_elements, s = 1; n > 1; n >>= 1, s <<= 1)
+    {
+        const size_t m = n / 2;
+        for (size_t p = 0; p < m; ++p)
+        {
+            const Complex w = twiddles[p * s];
+            const Complex * a = x + s * p;
+            const Complex * b = x + s * (p + m);
+            Complex * even = y + s * (2 * p);
+            Complex * odd = y + s * (2 * p + 1);
+            for (size_t q = 0; q < s; ++q)
+            {
+                even[q] = a[q] + b[q];
+                odd[q] = (a[q] - b[q]) * w;
+            }
+        }
+
+        Complex * buf = x;
+        x = y;
+        y = buf;
+    }
+
+    // an odd number of passes leaves the result in the scratch buffer
+    if (x != reinterpret_cast<Complex *>(data))
+    {
+        for (size_t i = 0; i < num_elements; ++i)
+            data[i] = scratch[i];
+    }
+}
+
+inline void transform(complex_type * data, const FFTPlan & plan, const FFT_algorithm algorithm)
+{
+    switch (algorithm)
+    {
+    case FFT_RADIX4:
+        radix4Transform(data, plan);
+        break;
+    case FFT_STOCKHAM:
+        stockhamTransform(data, plan);
+        break;
+    default:
+        radix2Transform(data, plan);
+        break;
+    }
+}
+
+} // namespace engines
+} // namespace impl
+} // namespace simple_fft
+
+#endif // __SIMPLE_FFT__FFT_ENGINES_HPP__
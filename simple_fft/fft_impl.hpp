@@ -3,41 +3,24 @@
 
 #include "fft_settings.h"
 #include "error_handling.hpp"
+#include "fft_engines.hpp"
+#include "fft_mixed_radix.hpp"
+#include "fft_plan.hpp"
 #include <cstddef>
 #include <math.h>
 #include <vector>
 
 using std::size_t;
 
-#ifndef M_PI
-#define M_PI 3.1415926535897932
-#endif
-
 namespace simple_fft {
 namespace impl {
 
-enum FFT_direction
-{
-    FFT_FORWARD = 0,
-    FFT_BACKWARD
-};
-
-// checking whether the size of array dimension is power of 2
-// via "complement and compare" method
-inline bool isPowerOfTwo(const size_t num)
-{
-    if ((num == 0) || !(num & (~num + 1)))
-        return false;
-
-    return true;
-}
-
 inline bool checkNumElements(const size_t num_elements, const char *& error_description)
 {
     using namespace error_handling;
 
-    if (!isPowerOfTwo(num_elements)) {
-        GetErrorDescription(EC_ONE_OF_DIMS_ISNT_POWER_OF_TWO, error_description);
+    if (num_elements == 0) {
+        GetErrorDescription(EC_NUM_OF_ELEMS_IS_ZERO, error_description);
         return false;
     }
 
@@ -118,34 +101,17 @@ inline void bufferExchangeHelper<std::vector<complex_type> >(std::vector<complex
 }
 
 template <class TComplexArray1D>
-void rearrangeData(TComplexArray1D & data, const size_t num_elements)
+void rearrangeData(TComplexArray1D & data, const FFTPlan & plan)
 {
     complex_type buf;
 
-    size_t target_index = 0;
-    size_t bit_mask;
-
-    for (size_t i = 0; i < num_elements; ++i)
+    for (size_t i = 0; i < plan.num_elements; ++i)
     {
+        size_t target_index = bitReversedIndex(plan, i);
         if (target_index > i)
         {
             bufferExchangeHelper(data, target_index, i, buf);
         }
-
-        // Initialize the bit mask
-        bit_mask = num_elements;
-
-        // While bit is 1
-        while (target_index & (bit_mask >>= 1)) // bit_mask = bit_mask >> 1
-        {
-            // Drop bit:
-            // & is bitwise AND,
-            // ~ is bitwise NOT
-            target_index &= ~bit_mask; // target_index = target_index & (~bit_mask)
-        }
-
-        // | is bitwise OR
-        target_index |= bit_mask; // target_index = target_index | bit_mask
     }
 }
 
@@ -183,60 +149,128 @@ inline void fftTransformHelper<std::vector<complex_type> >(std::vector<complex_t
 }
 
 template <class TComplexArray1D>
-bool makeTransform(TComplexArray1D & data, const size_t num_elements,
-                   const FFT_direction fft_direction, const char *& error_description)
+void makeTransform(TComplexArray1D & data, const FFTPlan & plan)
 {
-    using namespace error_handling;
-    using std::sin;
-
-    double local_pi;
-    switch(fft_direction)
-    {
-    case(FFT_FORWARD):
-        local_pi = -M_PI;
-        break;
-    case(FFT_BACKWARD):
-        local_pi = M_PI;
-        break;
-    default:
-        GetErrorDescription(EC_WRONG_FFT_DIRECTION, error_description);
-        return false;
-    }
+    const size_t num_elements = plan.num_elements;
+    const complex_type * twiddles = plan.twiddles.data();
 
     // declare variables to cycle the bits of initial signal
-    size_t next, match;
-    real_type sine;
-    real_type delta;
-    complex_type mult, factor, product;
-
-    // NOTE: user's complex type should have constructor like
-    // "complex(real, imag)", where each of real and imag has
-    // real type.
+    size_t next, match, twiddle_stride;
+    complex_type product;
 
     // cycle for all bit positions of initial signal
     for (size_t i = 1; i < num_elements; i <<= 1)
     {
         next = i << 1;  // getting the next bit
-        delta = local_pi / i;    // angle increasing
-        sine = sin(0.5 * delta);    // supplementary sin
-        // multiplier for trigonometric recurrence
-        mult = complex_type(-2.0 * sine * sine, sin(delta));
-        factor = 1.0;   // start transform factor
+        twiddle_stride = num_elements / next;   // exp(+-2*pi*i*j/next) is twiddles[j * twiddle_stride]
 
         for (size_t j = 0; j < i; ++j) // iterations through groups
                                        // with different transform factors
         {
+            const complex_type factor = twiddles[j * twiddle_stride];
             for (size_t k = j; k < num_elements; k += next) // iterations through
                                                             // pairs within group
             {
                 match = k + i;
                 fftTransformHelper(data, match, k, product, factor);
             }
-            factor = mult * factor + factor;
         }
     }
+}
 
-    return true;
+// element access for transforms going through contiguous buffers
+template <class TRealArray1D>
+inline real_type getRealValue(const TRealArray1D & data, const size_t index)
+{
+#ifdef __USE_SQUARE_BRACKETS_FOR_ELEMENT_ACCESS_OPERATOR
+    return data[index];
+#else
+    return data(index);
+#endif
+}
+
+// NOTE: explicit template specialization for the case of std::vector<real_type>,
+// which only has square brackets for element access operator.
+template <>
+inline real_type getRealValue<std::vector<real_type> >(const std::vector<real_type> & data,
+                                                       const size_t index)
+{
+    return data[index];
+}
+
+template <class TComplexArray1D>
+inline complex_type getComplexValue(const TComplexArray1D & data, const size_t index)
+{
+#ifdef __USE_SQUARE_BRACKETS_FOR_ELEMENT_ACCESS_OPERATOR
+    return data[index];
+#else
+    return data(index);
+#endif
+}
+
+// NOTE: explicit template specialization for the case of std::vector<complex_type>,
+// which only has square brackets for element access operator.
+template <>
+inline complex_type getComplexValue<std::vector<complex_type> >(const std::vector<complex_type> & data,
+                                                                const size_t index)
+{
+    return data[index];
+}
+
+template <class TComplexArray1D>
+inline void setComplexValue(TComplexArray1D & data, const size_t index,
+                            const complex_type & value)
+{
+#ifdef __USE_SQUARE_BRACKETS_FOR_ELEMENT_ACCESS_OPERATOR
+    data[index] = value;
+#else
+    data(index) = value;
+#endif
+}
+
+// NOTE: explicit template specialization for the case of std::vector<complex_type>,
+// which only has square brackets for element access operator.
+template <>
+inline void setComplexValue<std::vector<complex_type> >(std::vector<complex_type> & data,
+                                                        const size_t index,
+                                                        const complex_type & value)
+{
+    data[index] = value;
+}
+
+// Runs the 1D transform selected with SetAlgorithm. Radix-2 works in place
+// through the element access operator of any array class; the other engines
+// and the transforms of sizes which are not a power of two need contiguous
+// storage, so the data goes through a per-thread copy.
+template <class TComplexArray1D>
+void transformData(TComplexArray1D & data, const FFTPlan & plan)
+{
+    const FFT_algorithm algorithm = getAlgorithm();
+    if ((FFT_RADIX2 == algorithm) && plan.power_of_two) {
+        rearrangeData(data, plan);
+        makeTransform(data, plan);
+        return;
+    }
+
+    const size_t num_elements = plan.num_elements;
+    thread_local std::vector<complex_type> contiguous;
+    contiguous.resize(num_elements);
+    for (size_t i = 0; i < num_elements; ++i)
+        contiguous[i] = getComplexValue(data, i);
+
+    transformContiguous(contiguous.data(), plan, algorithm);
+
+    for (size_t i = 0; i < num_elements; ++i)
+        setComplexValue(data, i, contiguous[i]);
+}
+
+// NOTE: explicit template specialization for the case of std::vector<complex_type>,
+// whose elements are contiguous and can be handed to any engine directly.
+template <>
+inline void transformData<std::vector<complex_type> >(std::vector<complex_type> & data,
+                                                      const FFTPlan & plan)
+{
+    transformContiguous(data.data(), plan, getAlgorithm());
 }
 
 // Generic template for complex FFT followed by its explicit specializations
@@ -257,12 +291,13 @@ struct CFFT<TComplexArray1D,1>
             return false;
         }
 
-        rearrangeData(data, size);
-
-        if(!makeTransform(data, size, fft_direction, error_description)) {
+        const FFTPlan * plan = getPlan(size, fft_direction, error_description);
+        if(!plan) {
             return false;
         }
 
+        transformData(data, *plan);
+
         if (FFT_BACKWARD == fft_direction) {
             scaleValues(data, size);
         }
@@ -271,6 +306,82 @@ struct CFFT<TComplexArray1D,1>
     }
 };
 
+// 1D real-input forward FFT, producing only the size/2+1 unique bins: the
+// remaining ones follow from Hermitian symmetry, X[size-k] = conj(X[k]).
+// The even-sized real signal is packed into a complex one of half the size,
+// z[n] = x[2n] + i*x[2n+1], whose spectrum is then split back into the
+// spectra of the even and odd samples and recombined with one more butterfly.
+// That costs about half of a full complex FFT of the same size. Odd sizes
+// cannot be packed and run a full complex FFT instead.
+template <class TRealArray1D, class TComplexArray1D>
+bool makeRealTransform(const TRealArray1D & data_in, TComplexArray1D & data_out,
+                       const size_t size, const char *& error_description)
+{
+    if(!checkNumElements(size, error_description)) {
+        return false;
+    }
+
+    thread_local std::vector<complex_type> packed;
+
+    // a single sample has nothing to pack
+    if (size < 2) {
+        setComplexValue(data_out, 0, complex_type(getRealValue(data_in, 0), 0.0));
+        return true;
+    }
+
+    if (size % 2 != 0) {
+        packed.resize(size);
+        for (size_t n = 0; n < size; ++n) {
+            packed[n] = complex_type(getRealValue(data_in, n), 0.0);
+        }
+
+        if(!CFFT<std::vector<complex_type>,1>::FFT_inplace(packed, size, FFT_FORWARD,
+                                                           error_description))
+        {
+            return false;
+        }
+
+        for (size_t k = 0; k <= size / 2; ++k) {
+            setComplexValue(data_out, k, packed[k]);
+        }
+        return true;
+    }
+
+    const size_t half = size / 2;
+    packed.resize(half);
+    for (size_t n = 0; n < half; ++n) {
+        packed[n] = complex_type(getRealValue(data_in, 2 * n), getRealValue(data_in, 2 * n + 1));
+    }
+
+    if(!CFFT<std::vector<complex_type>,1>::FFT_inplace(packed, half, FFT_FORWARD,
+                                                       error_description))
+    {
+        return false;
+    }
+
+    // the full size plan holds the exp(-2*pi*i*k/size) twiddles for k < size/2
+    const FFTPlan * plan = getPlan(size, FFT_FORWARD, error_description);
+    if(!plan) {
+        return false;
+    }
+
+    const complex_type * twiddles = plan->twiddles.data();
+    const complex_type minus_half_i(0.0, -0.5);
+    for (size_t k = 0; k <= half; ++k)
+    {
+        const complex_type z = packed[(k == half) ? 0 : k];
+        const complex_type z_mirror = std::conj(packed[(k == 0) ? 0 : half - k]);
+
+        const complex_type even = (z + z_mirror) * 0.5;
+        const complex_type odd = (z - z_mirror) * minus_half_i;
+        const complex_type factor = (k == half) ? complex_type(-1.0, 0.0) : twiddles[k];
+
+        setComplexValue(data_out, k, even + factor * odd);
+    }
+
+    return true;
+}
+
 // 2D FFT
 template <class TComplexArray2D>
 struct CFFT<TComplexArray2D,2>
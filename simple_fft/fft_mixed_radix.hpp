@@ -0,0 +1,305 @@
+#ifndef __SIMPLE_FFT__FFT_MIXED_RADIX_HPP__
+#define __SIMPLE_FFT__FFT_MIXED_RADIX_HPP__
+
+#include "fft_settings.h"
+#include "fft_engines.hpp"
+#include "fft_plan.hpp"
+#include <cstddef>
+#include <vector>
+
+using std::size_t;
+
+// 1D transforms of sizes which are not a power of two:
+//  - sizes made of the factors 2, 3, 5 and 7 run one Stockham autosort pass per
+//    factor, with a written out butterfly for each radix;
+//  - any other size goes through Bluestein's algorithm, which rewrites the DFT
+//    as a cyclic convolution with a chirp and evaluates that convolution with
+//    power of two FFTs of at least 2N - 1 points, about 6 times the work of a
+//    power of two transform of similar size.
+
+namespace simple_fft {
+namespace impl {
+
+// complex product written out, see engines::Complex
+inline complex_type multiply(const complex_type & a, const complex_type & b)
+{
+    return complex_type(a.real() * b.real() - a.imag() * b.imag(),
+                        a.real() * b.imag() + a.imag() * b.real());
+}
+
+// i * v
+inline complex_type multiplyByI(const complex_type & v)
+{
+    return complex_type(-v.imag(), v.real());
+}
+
+// One butterfly of a mixed radix pass: the DFT of the Radix inputs
+// a_j = x[j * x_stride], out_r = sum_j a_j * w_Radix^(j*r), with
+// w_Radix = cosines[1] + i * sines[1] the Radix-th root of unity, then stored
+// as y[r * y_stride] = out_r * w[r] (w[0] being 1). For the odd
+// radices output r pairs with output Radix - r: with S_j = a_j + a_(Radix-j)
+// and D_j = a_j - a_(Radix-j),
+//     out_r, out_(Radix-r) = a_0 + sum_j cos_jr * S_j  +-  i * sum_j sin_jr * D_j
+// which takes real rather than complex products. They are written out for each
+// radix so that every temporary stays in a register.
+template <size_t Radix>
+struct Butterfly;
+
+template <>
+struct Butterfly<2>
+{
+    static void apply(const complex_type * x, const size_t x_stride, complex_type * y,
+                      const size_t y_stride, const complex_type * w, const real_type *,
+                      const real_type *)
+    {
+        const complex_type a0 = x[0];
+        const complex_type a1 = x[x_stride];
+        y[0] = a0 + a1;
+        y[y_stride] = multiply(a0 - a1, w[1]);
+    }
+};
+
+template <>
+struct Butterfly<3>
+{
+    static void apply(const complex_type * x, const size_t x_stride, complex_type * y,
+                      const size_t y_stride, const complex_type * w, const real_type * cosines,
+                      const real_type * sines)
+    {
+        const complex_type a0 = x[0];
+        const complex_type a1 = x[x_stride];
+        const complex_type a2 = x[2 * x_stride];
+        const complex_type s1 = a1 + a2, d1 = a1 - a2;
+        const complex_type even = a0 + cosines[1] * s1;
+        const complex_type odd = multiplyByI(sines[1] * d1);
+        y[0] = a0 + s1;
+        y[y_stride] = multiply(even + odd, w[1]);
+        y[2 * y_stride] = multiply(even - odd, w[2]);
+    }
+};
+
+template <>
+struct Butterfly<4>
+{
+    static void apply(const complex_type * x, const size_t x_stride, complex_type * y,
+                      const size_t y_stride, const complex_type * w, const real_type *,
+                      const real_type * sines)
+    {
+        const complex_type a0 = x[0];
+        const complex_type a1 = x[x_stride];
+        const complex_type a2 = x[2 * x_stride];
+        const complex_type a3 = x[3 * x_stride];
+        // w is -i forward and +i backward, w^2 = -1
+        const complex_type t0 = a0 + a2;
+        const complex_type t1 = a0 - a2;
+        const complex_type t2 = a1 + a3;
+        const complex_type t3 = multiplyByI(sines[1] * (a1 - a3));
+        y[0] = t0 + t2;
+        y[y_stride] = multiply(t1 + t3, w[1]);
+        y[2 * y_stride] = multiply(t0 - t2, w[2]);
+        y[3 * y_stride] = multiply(t1 - t3, w[3]);
+    }
+};
+
+template <>
+struct Butterfly<5>
+{
+    static void apply(const complex_type * x, const size_t x_stride, complex_type * y,
+                      const size_t y_stride, const complex_type * w, const real_type * cosines,
+                      const real_type * sines)
+    {
+        const complex_type a0 = x[0];
+        const complex_type a1 = x[x_stride];
+        const complex_type a2 = x[2 * x_stride];
+        const complex_type a3 = x[3 * x_stride];
+        const complex_type a4 = x[4 * x_stride];
+        const complex_type s1 = a1 + a4, d1 = a1 - a4;
+        const complex_type s2 = a2 + a3, d2 = a2 - a3;
+        const real_type c1 = cosines[1], c2 = cosines[2];
+        const real_type n1 = sines[1], n2 = sines[2];
+
+        // w^3 and w^4 are the conjugates of w^2 and w
+        const complex_type even1 = a0 + c1 * s1 + c2 * s2;
+        const complex_type odd1 = multiplyByI(n1 * d1 + n2 * d2);
+        const complex_type even2 = a0 + c2 * s1 + c1 * s2;
+        const complex_type odd2 = multiplyByI(n2 * d1 - n1 * d2);
+        y[0] = a0 + s1 + s2;
+        y[y_stride] = multiply(even1 + odd1, w[1]);
+        y[4 * y_stride] = multiply(even1 - odd1, w[4]);
+        y[2 * y_stride] = multiply(even2 + odd2, w[2]);
+        y[3 * y_stride] = multiply(even2 - odd2, w[3]);
+    }
+};
+
+template <>
+struct Butterfly<7>
+{
+    static void apply(const complex_type * x, const size_t x_stride, complex_type * y,
+                      const size_t y_stride, const complex_type * w, const real_type * cosines,
+                      const real_type * sines)
+    {
+        const complex_type a0 = x[0];
+        const complex_type a1 = x[x_stride];
+        const complex_type a2 = x[2 * x_stride];
+        const complex_type a3 = x[3 * x_stride];
+        const complex_type a4 = x[4 * x_stride];
+        const complex_type a5 = x[5 * x_stride];
+        const complex_type a6 = x[6 * x_stride];
+        const complex_type s1 = a1 + a6, d1 = a1 - a6;
+        const complex_type s2 = a2 + a5, d2 = a2 - a5;
+        const complex_type s3 = a3 + a4, d3 = a3 - a4;
+        const real_type c1 = cosines[1], c2 = cosines[2], c3 = cosines[3];
+        const real_type n1 = sines[1], n2 = sines[2], n3 = sines[3];
+
+        // w^4, w^5 and w^6 are the conjugates of w^3, w^2 and w
+        const complex_type even1 = a0 + c1 * s1 + c2 * s2 + c3 * s3;
+        const complex_type odd1 = multiplyByI(n1 * d1 + n2 * d2 + n3 * d3);
+        const complex_type even2 = a0 + c2 * s1 + c3 * s2 + c1 * s3;
+        const complex_type odd2 = multiplyByI(n2 * d1 - n3 * d2 - n1 * d3);
+        const complex_type even3 = a0 + c3 * s1 + c1 * s2 + c2 * s3;
+        const complex_type odd3 = multiplyByI(n3 * d1 - n1 * d2 + n2 * d3);
+        y[0] = a0 + s1 + s2 + s3;
+        y[y_stride] = multiply(even1 + odd1, w[1]);
+        y[6 * y_stride] = multiply(even1 - odd1, w[6]);
+        y[2 * y_stride] = multiply(even2 + odd2, w[2]);
+        y[5 * y_stride] = multiply(even2 - odd2, w[5]);
+        y[3 * y_stride] = multiply(even3 + odd3, w[3]);
+        y[4 * y_stride] = multiply(even3 - odd3, w[4]);
+    }
+};
+
+// One Stockham pass of radix Radix over sub-transforms of length n whose
+// elements are interleaved with stride s, n * s = N. With m = n / Radix, each
+// output element is
+//     y[q + s*(Radix*k + r)] = w_n^(k*r) * sum_j x[q + s*(k + j*m)] * w_Radix^(j*r)
+// for k < m, r < Radix and q < s, w_n being the n-th root of unity of the
+// plan's direction, twiddles[N / n].
+template <size_t Radix>
+void mixedRadixPass(const complex_type * x, complex_type * y, const FFTPlan & plan,
+                    const size_t n, const size_t s)
+{
+    const size_t num_elements = plan.num_elements;
+    const complex_type * twiddles = plan.twiddles.data();
+    const size_t m = n / Radix;
+
+    // w_Radix^j for j < Radix
+    real_type cosines[Radix], sines[Radix];
+    for (size_t j = 0; j < Radix; ++j)
+    {
+        cosines[j] = twiddles[j * (num_elements / Radix)].real();
+        sines[j] = twiddles[j * (num_elements / Radix)].imag();
+    }
+
+    complex_type w[Radix];
+    for (size_t k = 0; k < m; ++k)
+    {
+        for (size_t r = 0; r < Radix; ++r)
+            w[r] = twiddles[k * r * s];
+
+        const complex_type * x_k = x + s * k;
+        complex_type * y_k = y + s * Radix * k;
+        for (size_t q = 0; q < s; ++q)
+            Butterfly<Radix>::apply(x_k + q, s * m, y_k + q, s, w, cosines, sines);
+    }
+}
+
+inline void mixedRadixTransform(complex_type * data, const FFTPlan & plan)
+{
+    const size_t num_elements = plan.num_elements;
+
+    thread_local std::vector<complex_type> scratch;
+    scratch.resize(num_elements);
+
+    complex_type * x = data;
+    complex_type * y = scratch.data();
+    size_t n = num_elements, s = 1;
+    for (size_t i = 0; i < plan.factors.size(); ++i)
+    {
+        const size_t radix = plan.factors[i];
+        switch (radix)
+        {
+        case 2: mixedRadixPass<2>(x, y, plan, n, s); break;
+        case 3: mixedRadixPass<3>(x, y, plan, n, s); break;
+        case 4: mixedRadixPass<4>(x, y, plan, n, s); break;
+        case 5: mixedRadixPass<5>(x, y, plan, n, s); break;
+        default: mixedRadixPass<7>(x, y, plan, n, s); break;
+        }
+        n /= radix;
+        s *= radix;
+
+        complex_type * buf = x;
+        x = y;
+        y = buf;
+    }
+
+    if (x != data)
+    {
+        for (size_t i = 0; i < num_elements; ++i)
+            data[i] = scratch[i];
+    }
+}
+
+// Bluestein: with n*k = (n^2 + k^2 - (k-n)^2) / 2, the DFT becomes
+//     X[k] = chirp[k] * sum_n (x[n] * chirp[n]) * conj(chirp[k-n])
+// a convolution of x*chirp with the conjugate chirp, done by multiplying their
+// spectra. The power of two sub-transforms use the selected engine.
+inline void bluesteinTransform(complex_type * data, const FFTPlan & plan,
+                               const FFT_algorithm algorithm)
+{
+    const size_t num_elements = plan.num_elements;
+    const size_t conv_size = plan.bluestein_size;
+    const complex_type * chirp = plan.chirp.data();
+
+    // the directions are valid, so getPlan cannot fail here
+    const char * error_description = nullptr;
+    const FFTPlan & forward = *getPlan(conv_size, FFT_FORWARD, error_description);
+    std::vector<complex_type> & kernel = plan.bluestein_kernel;
+    if (kernel.empty())
+    {
+        // conj(chirp[|j|]) for -N < j < N, wrapped around the convolution size
+        kernel.assign(conv_size, complex_type(0.0, 0.0));
+        kernel[0] = std::conj(chirp[0]);
+        for (size_t j = 1; j < num_elements; ++j)
+            kernel[j] = kernel[conv_size - j] = std::conj(chirp[j]);
+
+        engines::transform(kernel.data(), forward, algorithm);
+        const real_type mult = 1.0 / conv_size;
+        for (size_t j = 0; j < conv_size; ++j)
+            kernel[j] *= mult;
+    }
+
+    thread_local std::vector<complex_type> conv;
+    conv.resize(conv_size);
+    for (size_t j = 0; j < num_elements; ++j)
+        conv[j] = multiply(data[j], chirp[j]);
+    for (size_t j = num_elements; j < conv_size; ++j)
+        conv[j] = complex_type(0.0, 0.0);
+
+    engines::transform(conv.data(), forward, algorithm);
+    for (size_t j = 0; j < conv_size; ++j)
+        conv[j] = multiply(conv[j], kernel[j]);
+
+    // the kernel carries the 1/conv_size of the inverse transform
+    const FFTPlan & backward = *getPlan(conv_size, FFT_BACKWARD, error_description);
+    engines::transform(conv.data(), backward, algorithm);
+
+    for (size_t k = 0; k < num_elements; ++k)
+        data[k] = multiply(conv[k], chirp[k]);
+}
+
+// 1D transform of contiguous data of any size with the plan's tables, unscaled
+inline void transformContiguous(complex_type * data, const FFTPlan & plan,
+                                const FFT_algorithm algorithm)
+{
+    if (plan.power_of_two)
+        engines::transform(data, plan, algorithm);
+    else if (!plan.factors.empty())
+        mixedRadixTransform(data, plan);
+    else
+        bluesteinTransform(data, plan, algorithm);
+}
+
+} // namespace impl
+} // namespace simple_fft
+
+#endif // __SIMPLE_FFT__FFT_MIXED_RADIX_HPP__
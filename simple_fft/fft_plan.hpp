@@ -0,0 +1,271 @@
+#ifndef __SIMPLE_FFT__FFT_PLAN_HPP__
+#define __SIMPLE_FFT__FFT_PLAN_HPP__
+
+#include "fft_settings.h"
+#include "error_handling.hpp"
+#include <cstddef>
+#include <math.h>
+#include <map>
+#include <vector>
+
+using std::size_t;
+
+#ifndef M_PI
+#define M_PI 3.1415926535897932
+#endif
+
+namespace simple_fft {
+namespace impl {
+
+enum FFT_direction
+{
+    FFT_FORWARD = 0,
+    FFT_BACKWARD
+};
+
+// Precomputed tables for 1D transforms of one size in one direction. Building
+// a plan costs a sin/cos pair per twiddle, after which every transform of that
+// size only does table lookups: no transcendental calls and no serial
+// "factor = mult * factor + factor" recurrence whose error grows with N.
+struct FFTPlan
+{
+    size_t num_elements;
+    FFT_direction direction;
+
+    // twiddles[k] = exp(+-2*pi*i*k/N) for k in [0, N/2), the sign being
+    // negative for the forward transform; sizes which are not a power of two
+    // have them for k in [0, N)
+    std::vector<complex_type> twiddles;
+
+    // power of two sizes use the tables below and the engines of fft_engines.hpp,
+    // other sizes the mixed radix or Bluestein transforms of fft_mixed_radix.hpp
+    bool power_of_two;
+
+    // for sizes made of the factors 2, 3, 5 and 7 only: the radix of every
+    // mixed radix pass, in order, with factors of 4 taken first
+    std::vector<size_t> factors;
+
+    // for sizes with larger prime factors, Bluestein's algorithm turns the DFT
+    // into a cyclic convolution of power of two size bluestein_size >= 2N - 1:
+    // chirp[n] = exp(-+pi*i*n^2/N) for n < N, and bluestein_kernel is the
+    // forward FFT of the conjugate chirp, wrapped around and zero padded,
+    // scaled by 1/bluestein_size. The kernel needs the FFT itself, so it is
+    // filled on the first transform of the plan (see bluesteinTransform);
+    // plans being per thread, that is race free.
+    size_t bluestein_size;
+    std::vector<complex_type> chirp;
+    mutable std::vector<complex_type> bluestein_kernel;
+
+    // the twiddles of each radix-2 stage laid out contiguously: the stage that
+    // combines pairs half elements apart uses exp(+-pi*i*j/half) for j < half,
+    // starting at stage_twiddles[half - 1]
+    std::vector<complex_type> stage_twiddles;
+
+    // log2(N)
+    size_t num_bits;
+
+    // bit_reversed[i] is i with its log2(N) bits reversed; only built for sizes
+    // below 2^c_blockedBitReversalMinBits, larger ones use the blocked
+    // permutation of fft_bit_reversal.hpp
+    std::vector<size_t> bit_reversed;
+
+    // for the blocked permutation, an index is split into its top, middle and
+    // bottom bits: block_reversed reverses the c_bitReversalBlockBits wide top
+    // and bottom parts, middle_reversed the num_bits - 2 * c_bitReversalBlockBits
+    // bits in between
+    std::vector<size_t> block_reversed;
+    std::vector<size_t> middle_reversed;
+};
+
+// The blocked bit reversal moves tiles of 2^c_bitReversalBlockBits squared
+// elements, 16 KB of complex doubles which stay in L1 while being transposed
+static const size_t c_bitReversalBlockBits = 5;
+
+// Up to 2^12 complex doubles (64 KB) the swaps through the table hit the
+// cache anyway and cost no more than the blocked permutation
+static const size_t c_blockedBitReversalMinBits = 13;
+
+// value with its lowest num_bits bits reversed
+inline size_t reverseBits(const size_t value, const size_t num_bits)
+{
+    size_t reversed = 0;
+    for (size_t bit = 0; bit < num_bits; ++bit)
+        reversed |= ((value >> bit) & 1) << (num_bits - 1 - bit);
+    return reversed;
+}
+
+inline void buildReversalTable(std::vector<size_t> & table, const size_t num_bits)
+{
+    table.resize(size_t(1) << num_bits);
+    for (size_t i = 0; i < table.size(); ++i)
+        table[i] = reverseBits(i, num_bits);
+}
+
+inline bool usesBlockedBitReversal(const FFTPlan & plan)
+{
+    return plan.bit_reversed.empty();
+}
+
+// i with its log2(N) bits reversed, whichever tables the plan has
+inline size_t bitReversedIndex(const FFTPlan & plan, const size_t i)
+{
+    if (!usesBlockedBitReversal(plan))
+        return plan.bit_reversed[i];
+
+    const size_t block_bits = c_bitReversalBlockBits;
+    const size_t block_mask = (size_t(1) << block_bits) - 1;
+    const size_t top_shift = plan.num_bits - block_bits;
+    const size_t middle = (i >> block_bits) & (plan.middle_reversed.size() - 1);
+    return (plan.block_reversed[i & block_mask] << top_shift) |
+           (plan.middle_reversed[middle] << block_bits) |
+           plan.block_reversed[i >> top_shift];
+}
+
+// checking whether the size of array dimension is power of 2
+// via "complement and compare" method: the lowest set bit is the only one
+inline bool isPowerOfTwo(const size_t num)
+{
+    if ((num == 0) || ((num & (~num + 1)) != num))
+        return false;
+
+    return true;
+}
+
+// Splits num into the radices of the mixed radix transform, 4 first then
+// 2, 3, 5 and 7. Returns false if num has any other prime factor.
+inline bool factorize(size_t num, std::vector<size_t> & factors)
+{
+    static const size_t radices[] = { 4, 2, 3, 5, 7 };
+
+    factors.clear();
+    for (size_t i = 0; i < sizeof(radices) / sizeof(radices[0]); ++i)
+    {
+        while (num % radices[i] == 0)
+        {
+            factors.push_back(radices[i]);
+            num /= radices[i];
+        }
+    }
+
+    return num == 1;
+}
+
+inline void buildTwiddles(std::vector<complex_type> & twiddles, const size_t count,
+                          const size_t num_elements, const FFT_direction fft_direction)
+{
+    // compute every twiddle from its exact angle rather than by recurrence
+    const double sign = (fft_direction == FFT_FORWARD) ? -1.0 : 1.0;
+    twiddles.resize(count);
+    for (size_t k = 0; k < count; ++k)
+    {
+        double angle = sign * 2.0 * M_PI * double(k) / double(num_elements);
+        twiddles[k] = complex_type(cos(angle), sin(angle));
+    }
+}
+
+inline void buildPlan(FFTPlan & plan, const size_t num_elements,
+                      const FFT_direction fft_direction)
+{
+    plan.num_elements = num_elements;
+    plan.direction = fft_direction;
+    plan.power_of_two = isPowerOfTwo(num_elements);
+    plan.factors.clear();
+    plan.bluestein_size = 0;
+    plan.chirp.clear();
+    plan.bluestein_kernel.clear();
+    plan.stage_twiddles.clear();
+    plan.num_bits = 0;
+    plan.bit_reversed.clear();
+    plan.block_reversed.clear();
+    plan.middle_reversed.clear();
+
+    if (!plan.power_of_two)
+    {
+        buildTwiddles(plan.twiddles, num_elements, num_elements, fft_direction);
+        if (factorize(num_elements, plan.factors))
+            return;
+
+        plan.factors.clear();
+        plan.bluestein_size = 1;
+        while (plan.bluestein_size < 2 * num_elements - 1)
+            plan.bluestein_size <<= 1;
+
+        // n^2 grows past the precision of a double long before n does, so
+        // reduce it modulo 2N, the period of the chirp, in integers first
+        const double sign = (fft_direction == FFT_FORWARD) ? -1.0 : 1.0;
+        plan.chirp.resize(num_elements);
+        for (size_t n = 0; n < num_elements; ++n)
+        {
+            const unsigned long long n_squared =
+                (static_cast<unsigned long long>(n) * n) % (2ull * num_elements);
+            double angle = sign * M_PI * double(n_squared) / double(num_elements);
+            plan.chirp[n] = complex_type(cos(angle), sin(angle));
+        }
+        return;
+    }
+
+    buildTwiddles(plan.twiddles, num_elements / 2, num_elements, fft_direction);
+
+    plan.stage_twiddles.reserve(num_elements);
+    for (size_t stage_half = 1; stage_half < num_elements; stage_half <<= 1)
+    {
+        const size_t stride = num_elements / (2 * stage_half);
+        for (size_t j = 0; j < stage_half; ++j)
+            plan.stage_twiddles.push_back(plan.twiddles[j * stride]);
+    }
+
+    size_t num_bits = 0;
+    while ((size_t(1) << num_bits) < num_elements)
+        ++num_bits;
+
+    plan.num_bits = num_bits;
+    if (num_bits < c_blockedBitReversalMinBits)
+    {
+        buildReversalTable(plan.bit_reversed, num_bits);
+    }
+    else
+    {
+        buildReversalTable(plan.block_reversed, c_bitReversalBlockBits);
+        buildReversalTable(plan.middle_reversed, num_bits - 2 * c_bitReversalBlockBits);
+    }
+}
+
+// Returns the plan for the given size and direction, building it on first use.
+// Plans are cached per thread so concurrent transforms never share mutable
+// state, and stay valid for the lifetime of the thread.
+inline const FFTPlan * getPlan(const size_t num_elements, const FFT_direction fft_direction,
+                               const char *& error_description)
+{
+    using namespace error_handling;
+
+    if ((fft_direction != FFT_FORWARD) && (fft_direction != FFT_BACKWARD)) {
+        GetErrorDescription(EC_WRONG_FFT_DIRECTION, error_description);
+        return nullptr;
+    }
+
+    // most callers transform the same size over and over, so check the last
+    // plan handed out before searching the cache
+    thread_local const FFTPlan * last_plan = nullptr;
+    if (last_plan && (last_plan->num_elements == num_elements) &&
+        (last_plan->direction == fft_direction))
+    {
+        return last_plan;
+    }
+
+    thread_local std::map<std::pair<size_t, int>, FFTPlan> plans;
+    std::pair<size_t, int> key(num_elements, int(fft_direction));
+    std::map<std::pair<size_t, int>, FFTPlan>::iterator it = plans.find(key);
+    if (it == plans.end())
+    {
+        it = plans.insert(std::make_pair(key, FFTPlan())).first;
+        buildPlan(it->second, num_elements, fft_direction);
+    }
+
+    last_plan = &it->second;
+    return last_plan;
+}
+
+} // namespace impl
+} // namespace simple_fft
+
+#endif // __SIMPLE_FFT__FFT_PLAN_HPP__
@@ -3,6 +3,12 @@
 //    By default real_type is double and complex_type is std::complex<real_type>.
 // 2) If the array class uses square brackets for element access operator, define
 //    the macro __USE_SQUARE_BRACKETS_FOR_ELEMENT_ACCESS_OPERATOR
+// 3) Transforms of contiguous double precision data use AVX2 or AVX-512 butterflies
+//    when the CPU supports them. Define __SIMPLE_FFT_DISABLE_SIMD to always use the
+//    scalar ones.
+// 4) 1D transforms run on one of the engines listed in FFT_algorithm, which can be
+//    switched at runtime with simple_fft::SetAlgorithm. Define
+//    __SIMPLE_FFT_DEFAULT_ALGORITHM to the one used before any call to it.
 
 #ifndef __SIMPLE_FFT__FFT_SETTINGS_H__
 #define __SIMPLE_FFT__FFT_SETTINGS_H__
@@ -12,8 +18,27 @@
 typedef double real_type;
 typedef std::complex<real_type> complex_type;
 
+namespace simple_fft {
+
+enum FFT_algorithm
+{
+    FFT_RADIX2 = 0,     // in-place radix-2 with a bit reversal pass
+    FFT_RADIX4,         // in-place radix-4 with radix-8 leaves and a bit reversal pass
+    FFT_STOCKHAM        // radix-2 Stockham autosort through a scratch buffer
+};
+
+} // namespace simple_fft
+
+#ifndef __SIMPLE_FFT_DEFAULT_ALGORITHM
+#define __SIMPLE_FFT_DEFAULT_ALGORITHM simple_fft::FFT_RADIX4
+#endif
+
 //#ifndef __USE_SQUARE_BRACKETS_FOR_ELEMENT_ACCESS_OPERATOR
 //#define __USE_SQUARE_BRACKETS_FOR_ELEMENT_ACCESS_OPERATOR
 //#endif
 
+//#ifndef __SIMPLE_FFT_DISABLE_SIMD
+//#define __SIMPLE_FFT_DISABLE_SIMD
+//#endif
+
 #endif // __SIMPLE_FFT__FFT_SETTINGS_H__
@@ -0,0 +1,500 @@
+#ifndef __SIMPLE_FFT__FFT_SIMD_HPP__
+#define __SIMPLE_FFT__FFT_SIMD_HPP__
+
+#include "fft_settings.h"
+#include <cstddef>
+
+using std::size_t;
+
+// Radix-2 butterfly stages over contiguous double precision data, in scalar,
+// AVX2+FMA and AVX-512 flavors. The widest flavor the CPU and OS support is
+// picked at runtime through CPUID, so one binary runs everywhere. Define
+// __SIMPLE_FFT_DISABLE_SIMD (see fft_settings.h) to always use the scalar code.
+//
+// Every kernel runs one full stage of the transform: for each group of 2*half
+// elements, element k and k+half are combined with twiddle w[j], j = k % half:
+//     a' = a + w*b,  b' = a - w*b
+// The twiddles of a stage are contiguous, see FFTPlan::stage_twiddles.
+// The radix-4 kernels run two consecutive interleaved stages, half and 2*half,
+// in one pass over the data (see fft_engines.hpp).
+//
+// Two layouts are supported:
+//  - interleaved: std::complex<double> arrays, i.e. re, im, re, im, ...
+//  - split: separate real and imaginary planes with batch_size signals
+//    interleaved, element n of signal b at n * batch_size + b (see fft_batch.hpp)
+
+#if !defined(__SIMPLE_FFT_DISABLE_SIMD) && \
+    (defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__))
+#define __SIMPLE_FFT_X86_SIMD
+#endif
+
+#ifdef __SIMPLE_FFT_X86_SIMD
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define __SIMPLE_FFT_TARGET_AVX2
+#define __SIMPLE_FFT_TARGET_AVX512
+#else
+#include <cpuid.h>
+#define __SIMPLE_FFT_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define __SIMPLE_FFT_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+#endif
+
+namespace simple_fft {
+namespace impl {
+namespace simd {
+
+typedef void (*InterleavedStageKernel)(double * data, const size_t num_elements,
+                                       const size_t half, const double * twiddles);
+
+typedef void (*SplitStageKernel)(double * real, double * imag, const size_t num_elements,
+                                 const size_t half, const double * twiddles,
+                                 const size_t batch_size);
+
+typedef void (*Radix4PassKernel)(double * data, const size_t num_elements,
+                                 const size_t half, const double * first_twiddles,
+                                 const double * second_twiddles);
+
+struct StageKernels
+{
+    InterleavedStageKernel interleaved_stage;
+    SplitStageKernel split_stage;
+    Radix4PassKernel radix4_pass;
+    const char * name;
+};
+
+// scalar kernels, written out on plain doubles to stay clear of the NaN and
+// infinity recovery that std::complex multiplication does
+inline void interleavedStageScalar(double * data, const size_t num_elements,
+                                   const size_t half, const double * twiddles)
+{
+    for (size_t group = 0; group < num_elements; group += 2 * half)
+    {
+        double * a = data + 2 * group;
+        double * b = a + 2 * half;
+        for (size_t j = 0; j < half; ++j)
+        {
+            const double w_real = twiddles[2 * j];
+            const double w_imag = twiddles[2 * j + 1];
+            const double product_real = w_real * b[2 * j] - w_imag * b[2 * j + 1];
+            const double product_imag = w_real * b[2 * j + 1] + w_imag * b[2 * j];
+            b[2 * j] = a[2 * j] - product_real;
+            b[2 * j + 1] = a[2 * j + 1] - product_imag;
+            a[2 * j] += product_real;
+            a[2 * j + 1] += product_imag;
+        }
+    }
+}
+
+inline void splitButterflyScalar(double * real_a, double * imag_a, double * real_b,
+                                 double * imag_b, const double w_real, const double w_imag,
+                                 const size_t begin, const size_t end)
+{
+    for (size_t b = begin; b < end; ++b)
+    {
+        const double product_real = w_real * real_b[b] - w_imag * imag_b[b];
+        const double product_imag = w_real * imag_b[b] + w_imag * real_b[b];
+        real_b[b] = real_a[b] - product_real;
+        imag_b[b] = imag_a[b] - product_imag;
+        real_a[b] += product_real;
+        imag_a[b] += product_imag;
+    }
+}
+
+inline void splitStageScalar(double * real, double * imag, const size_t num_elements,
+                             const size_t half, const double * twiddles,
+                             const size_t batch_size)
+{
+    for (size_t group = 0; group < num_elements; group += 2 * half)
+    {
+        for (size_t j = 0; j < half; ++j)
+        {
+            const size_t k = (group + j) * batch_size;
+            const size_t match = k + half * batch_size;
+            splitButterflyScalar(real + k, imag + k, real + match, imag + match,
+                                 twiddles[2 * j], twiddles[2 * j + 1], 0, batch_size);
+        }
+    }
+}
+
+// For each group of 4*half elements and j < half, the elements x0..x3 at
+// j + n*half go through the stage of size half with w1 = first_twiddles[j]:
+//     b0 = x0 + w1*x1,  b1 = x0 - w1*x1,  b2 = x2 + w1*x3,  b3 = x2 - w1*x3
+// then through the stage of size 2*half with w2 = second_twiddles[j] and
+// w3 = second_twiddles[j + half]:
+//     x0 = b0 + w2*b2,  x2 = b0 - w2*b2,  x1 = b1 + w3*b3,  x3 = b1 - w3*b3
+inline void radix4PassScalar(double * data, const size_t num_elements, const size_t half,
+                             const double * first_twiddles, const double * second_twiddles)
+{
+    for (size_t group = 0; group < num_elements; group += 4 * half)
+    {
+        double * x0 = data + 2 * group;
+        double * x1 = x0 + 2 * half;
+        double * x2 = x1 + 2 * half;
+        double * x3 = x2 + 2 * half;
+        for (size_t j = 0; j < 2 * half; j += 2)
+        {
+            const double w1_real = first_twiddles[j], w1_imag = first_twiddles[j + 1];
+            const double t1_real = w1_real * x1[j] - w1_imag * x1[j + 1];
+            const double t1_imag = w1_real * x1[j + 1] + w1_imag * x1[j];
+            const double t3_real = w1_real * x3[j] - w1_imag * x3[j + 1];
+            const double t3_imag = w1_real * x3[j + 1] + w1_imag * x3[j];
+
+            const double b0_real = x0[j] + t1_real, b0_imag = x0[j + 1] + t1_imag;
+            const double b1_real = x0[j] - t1_real, b1_imag = x0[j + 1] - t1_imag;
+            const double b2_real = x2[j] + t3_real, b2_imag = x2[j + 1] + t3_imag;
+            const double b3_real = x2[j] - t3_real, b3_imag = x2[j + 1] - t3_imag;
+
+            const double w2_real = second_twiddles[j], w2_imag = second_twiddles[j + 1];
+            const double w3_real = second_twiddles[2 * half + j];
+            const double w3_imag = second_twiddles[2 * half + j + 1];
+            const double t2_real = w2_real * b2_real - w2_imag * b2_imag;
+            const double t2_imag = w2_real * b2_imag + w2_imag * b2_real;
+            const double t4_real = w3_real * b3_real - w3_imag * b3_imag;
+            const double t4_imag = w3_real * b3_imag + w3_imag * b3_real;
+
+            x0[j] = b0_real + t2_real;
+            x0[j + 1] = b0_imag + t2_imag;
+            x2[j] = b0_real - t2_real;
+            x2[j + 1] = b0_imag - t2_imag;
+            x1[j] = b1_real + t4_real;
+            x1[j + 1] = b1_imag + t4_imag;
+            x3[j] = b1_real - t4_real;
+            x3[j + 1] = b1_imag - t4_imag;
+        }
+    }
+}
+
+#ifdef __SIMPLE_FFT_X86_SIMD
+
+// w*v for the two complex numbers in each register
+__SIMPLE_FFT_TARGET_AVX2
+inline __m256d complexMultiplyAVX2(const __m256d v, const __m256d w)
+{
+    const __m256d w_real = _mm256_movedup_pd(w);
+    const __m256d w_imag = _mm256_permute_pd(w, 0xF);
+    const __m256d v_swapped = _mm256_permute_pd(v, 0x5);
+    return _mm256_fmaddsub_pd(v, w_real, _mm256_mul_pd(v_swapped, w_imag));
+}
+
+// two complex numbers per 256 bit register
+__SIMPLE_FFT_TARGET_AVX2
+inline void interleavedStageAVX2(double * data, const size_t num_elements,
+                                 const size_t half, const double * twiddles)
+{
+    if (half < 2) {
+        interleavedStageScalar(data, num_elements, half, twiddles);
+        return;
+    }
+
+    for (size_t group = 0; group < num_elements; group += 2 * half)
+    {
+        double * a = data + 2 * group;
+        double * b = a + 2 * half;
+        for (size_t j = 0; j < half; j += 2)
+        {
+            const __m256d w = _mm256_loadu_pd(twiddles + 2 * j);
+            const __m256d w_real = _mm256_movedup_pd(w);
+            const __m256d w_imag = _mm256_permute_pd(w, 0xF);
+            const __m256d va = _mm256_loadu_pd(a + 2 * j);
+            const __m256d vb = _mm256_loadu_pd(b + 2 * j);
+
+            // (br*wr - bi*wi, bi*wr + br*wi)
+            const __m256d vb_swapped = _mm256_permute_pd(vb, 0x5);
+            const __m256d product = _mm256_fmaddsub_pd(vb, w_real, _mm256_mul_pd(vb_swapped, w_imag));
+
+            _mm256_storeu_pd(a + 2 * j, _mm256_add_pd(va, product));
+            _mm256_storeu_pd(b + 2 * j, _mm256_sub_pd(va, product));
+        }
+    }
+}
+
+__SIMPLE_FFT_TARGET_AVX2
+inline void splitStageAVX2(double * real, double * imag, const size_t num_elements,
+                           const size_t half, const double * twiddles,
+                           const size_t batch_size)
+{
+    const size_t vector_end = batch_size & ~size_t(3);
+    for (size_t group = 0; group < num_elements; group += 2 * half)
+    {
+        for (size_t j = 0; j < half; ++j)
+        {
+            const size_t k = (group + j) * batch_size;
+            const size_t match = k + half * batch_size;
+            double * real_a = real + k;
+            double * imag_a = imag + k;
+            double * real_b = real + match;
+            double * imag_b = imag + match;
+
+            const __m256d w_real = _mm256_set1_pd(twiddles[2 * j]);
+            const __m256d w_imag = _mm256_set1_pd(twiddles[2 * j + 1]);
+            for (size_t b = 0; b < vector_end; b += 4)
+            {
+                const __m256d ar = _mm256_loadu_pd(real_a + b);
+                const __m256d ai = _mm256_loadu_pd(imag_a + b);
+                const __m256d br = _mm256_loadu_pd(real_b + b);
+                const __m256d bi = _mm256_loadu_pd(imag_b + b);
+                const __m256d product_real = _mm256_fmsub_pd(w_real, br, _mm256_mul_pd(w_imag, bi));
+                const __m256d product_imag = _mm256_fmadd_pd(w_real, bi, _mm256_mul_pd(w_imag, br));
+                _mm256_storeu_pd(real_a + b, _mm256_add_pd(ar, product_real));
+                _mm256_storeu_pd(imag_a + b, _mm256_add_pd(ai, product_imag));
+                _mm256_storeu_pd(real_b + b, _mm256_sub_pd(ar, product_real));
+                _mm256_storeu_pd(imag_b + b, _mm256_sub_pd(ai, product_imag));
+            }
+            splitButterflyScalar(real_a, imag_a, real_b, imag_b, twiddles[2 * j],
+                                 twiddles[2 * j + 1], vector_end, batch_size);
+        }
+    }
+}
+
+__SIMPLE_FFT_TARGET_AVX2
+inline void radix4PassAVX2(double * data, const size_t num_elements, const size_t half,
+                           const double * first_twiddles, const double * second_twiddles)
+{
+    if (half < 2) {
+        radix4PassScalar(data, num_elements, half, first_twiddles, second_twiddles);
+        return;
+    }
+
+    for (size_t group = 0; group < num_elements; group += 4 * half)
+    {
+        double * x0 = data + 2 * group;
+        double * x1 = x0 + 2 * half;
+        double * x2 = x1 + 2 * half;
+        double * x3 = x2 + 2 * half;
+        for (size_t j = 0; j < 2 * half; j += 4)
+        {
+            const __m256d w1 = _mm256_loadu_pd(first_twiddles + j);
+            const __m256d t1 = complexMultiplyAVX2(_mm256_loadu_pd(x1 + j), w1);
+            const __m256d t3 = complexMultiplyAVX2(_mm256_loadu_pd(x3 + j), w1);
+            const __m256d a0 = _mm256_loadu_pd(x0 + j);
+            const __m256d a2 = _mm256_loadu_pd(x2 + j);
+            const __m256d b0 = _mm256_add_pd(a0, t1);
+            const __m256d b1 = _mm256_sub_pd(a0, t1);
+            const __m256d b2 = _mm256_add_pd(a2, t3);
+            const __m256d b3 = _mm256_sub_pd(a2, t3);
+
+            const __m256d t2 = complexMultiplyAVX2(b2, _mm256_loadu_pd(second_twiddles + j));
+            const __m256d t4 = complexMultiplyAVX2(b3, _mm256_loadu_pd(second_twiddles + 2 * half + j));
+            _mm256_storeu_pd(x0 + j, _mm256_add_pd(b0, t2));
+            _mm256_storeu_pd(x2 + j, _mm256_sub_pd(b0, t2));
+            _mm256_storeu_pd(x1 + j, _mm256_add_pd(b1, t4));
+            _mm256_storeu_pd(x3 + j, _mm256_sub_pd(b1, t4));
+        }
+    }
+}
+
+// GCC's AVX-512 headers start from _mm512_undefined_pd(), which trips
+// -Wmaybe-uninitialized when inlined into the kernels below
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+// four complex numbers per 512 bit register
+__SIMPLE_FFT_TARGET_AVX512
+inline void interleavedStageAVX512(double * data, const size_t num_elements,
+                                   const size_t half, const double * twiddles)
+{
+    if (half < 4) {
+        interleavedStageAVX2(data, num_elements, half, twiddles);
+        return;
+    }
+
+    for (size_t group = 0; group < num_elements; group += 2 * half)
+    {
+        double * a = data + 2 * group;
+        double * b = a + 2 * half;
+        for (size_t j = 0; j < half; j += 4)
+        {
+            const __m512d w = _mm512_loadu_pd(twiddles + 2 * j);
+            const __m512d w_real = _mm512_unpacklo_pd(w, w);
+            const __m512d w_imag = _mm512_unpackhi_pd(w, w);
+            const __m512d va = _mm512_loadu_pd(a + 2 * j);
+            const __m512d vb = _mm512_loadu_pd(b + 2 * j);
+
+            const __m512d vb_swapped = _mm512_shuffle_pd(vb, vb, 0x55);
+            const __m512d product = _mm512_fmaddsub_pd(vb, w_real, _mm512_mul_pd(vb_swapped, w_imag));
+
+            _mm512_storeu_pd(a + 2 * j, _mm512_add_pd(va, product));
+            _mm512_storeu_pd(b + 2 * j, _mm512_sub_pd(va, product));
+        }
+    }
+}
+
+__SIMPLE_FFT_TARGET_AVX512
+inline void splitStageAVX512(double * real, double * imag, const size_t num_elements,
+                             const size_t half, const double * twiddles,
+                             const size_t batch_size)
+{
+    const size_t vector_end = batch_size & ~size_t(7);
+    for (size_t group = 0; group < num_elements; group += 2 * half)
+    {
+        for (size_t j = 0; j < half; ++j)
+        {
+            const size_t k = (group + j) * batch_size;
+            const size_t match = k + half * batch_size;
+            double * real_a = real + k;
+            double * imag_a = imag + k;
+            double * real_b = real + match;
+            double * imag_b = imag + match;
+
+            const __m512d w_real = _mm512_set1_pd(twiddles[2 * j]);
+            const __m512d w_imag = _mm512_set1_pd(twiddles[2 * j + 1]);
+            for (size_t b = 0; b < vector_end; b += 8)
+            {
+                const __m512d ar = _mm512_loadu_pd(real_a + b);
+                const __m512d ai = _mm512_loadu_pd(imag_a + b);
+                const __m512d br = _mm512_loadu_pd(real_b + b);
+                const __m512d bi = _mm512_loadu_pd(imag_b + b);
+                const __m512d product_real = _mm512_fmsub_pd(w_real, br, _mm512_mul_pd(w_imag, bi));
+                const __m512d product_imag = _mm512_fmadd_pd(w_real, bi, _mm512_mul_pd(w_imag, br));
+                _mm512_storeu_pd(real_a + b, _mm512_add_pd(ar, product_real));
+                _mm512_storeu_pd(imag_a + b, _mm512_add_pd(ai, product_imag));
+                _mm512_storeu_pd(real_b + b, _mm512_sub_pd(ar, product_real));
+                _mm512_storeu_pd(imag_b + b, _mm512_sub_pd(ai, product_imag));
+            }
+            splitButterflyScalar(real_a, imag_a, real_b, imag_b, twiddles[2 * j],
+                                 twiddles[2 * j + 1], vector_end, batch_size);
+        }
+    }
+}
+
+// w*v for the four complex numbers in each register
+__SIMPLE_FFT_TARGET_AVX512
+inline __m512d complexMultiplyAVX512(const __m512d v, const __m512d w)
+{
+    const __m512d w_real = _mm512_unpacklo_pd(w, w);
+    const __m512d w_imag = _mm512_unpackhi_pd(w, w);
+    const __m512d v_swapped = _mm512_shuffle_pd(v, v, 0x55);
+    return _mm512_fmaddsub_pd(v, w_real, _mm512_mul_pd(v_swapped, w_imag));
+}
+
+__SIMPLE_FFT_TARGET_AVX512
+inline void radix4PassAVX512(double * data, const size_t num_elements, const size_t half,
+                             const double * first_twiddles, const double * second_twiddles)
+{
+    if (half < 4) {
+        radix4PassAVX2(data, num_elements, half, first_twiddles, second_twiddles);
+        return;
+    }
+
+    for (size_t group = 0; group < num_elements; group += 4 * half)
+    {
+        double * x0 = data + 2 * group;
+        double * x1 = x0 + 2 * half;
+        double * x2 = x1 + 2 * half;
+        double * x3 = x2 + 2 * half;
+        for (size_t j = 0; j < 2 * half; j += 8)
+        {
+            const __m512d w1 = _mm512_loadu_pd(first_twiddles + j);
+            const __m512d t1 = complexMultiplyAVX512(_mm512_loadu_pd(x1 + j), w1);
+            const __m512d t3 = complexMultiplyAVX512(_mm512_loadu_pd(x3 + j), w1);
+            const __m512d a0 = _mm512_loadu_pd(x0 + j);
+            const __m512d a2 = _mm512_loadu_pd(x2 + j);
+            const __m512d b0 = _mm512_add_pd(a0, t1);
+            const __m512d b1 = _mm512_sub_pd(a0, t1);
+            const __m512d b2 = _mm512_add_pd(a2, t3);
+            const __m512d b3 = _mm512_sub_pd(a2, t3);
+
+            const __m512d t2 = complexMultiplyAVX512(b2, _mm512_loadu_pd(second_twiddles + j));
+            const __m512d t4 = complexMultiplyAVX512(b3, _mm512_loadu_pd(second_twiddles + 2 * half + j));
+            _mm512_storeu_pd(x0 + j, _mm512_add_pd(b0, t2));
+            _mm512_storeu_pd(x2 + j, _mm512_sub_pd(b0, t2));
+            _mm512_storeu_pd(x1 + j, _mm512_add_pd(b1, t4));
+            _mm512_storeu_pd(x3 + j, _mm512_sub_pd(b1, t4));
+        }
+    }
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+inline void cpuid(int info[4], const int leaf, const int subleaf)
+{
+#ifdef _MSC_VER
+    __cpuidex(info, leaf, subleaf);
+#else
+    unsigned int a = 0, b = 0, c = 0, d = 0;
+    __cpuid_count(leaf, subleaf, a, b, c, d);
+    info[0] = int(a);
+    info[1] = int(b);
+    info[2] = int(c);
+    info[3] = int(d);
+#endif
+}
+
+// the register state the OS saves on context switches (XCR0)
+inline unsigned long long xgetbv0()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int eax = 0, edx = 0;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+}
+
+inline StageKernels detectStageKernels()
+{
+    StageKernels scalar = { interleavedStageScalar, splitStageScalar, radix4PassScalar, "scalar" };
+    StageKernels avx2 = { interleavedStageAVX2, splitStageAVX2, radix4PassAVX2, "avx2" };
+    StageKernels avx512 = { interleavedStageAVX512, splitStageAVX512, radix4PassAVX512,
+                              "avx512" };
+
+    int info[4];
+    cpuid(info, 0, 0);
+    const int max_leaf = info[0];
+    if (max_leaf < 7)
+        return scalar;
+
+    // AVX needs the CPU to have it and the OS to save the YMM registers
+    cpuid(info, 1, 0);
+    const bool has_fma = (info[2] & (1 << 12)) != 0;
+    const bool has_osxsave = (info[2] & (1 << 27)) != 0;
+    const bool has_avx = (info[2] & (1 << 28)) != 0;
+    if (!has_fma || !has_osxsave || !has_avx)
+        return scalar;
+
+    const unsigned long long xcr0 = xgetbv0();
+    if ((xcr0 & 0x6) != 0x6)
+        return scalar;
+
+    cpuid(info, 7, 0);
+    const bool has_avx2 = (info[1] & (1 << 5)) != 0;
+    const bool has_avx512f = (info[1] & (1 << 16)) != 0;
+    if (!has_avx2)
+        return scalar;
+
+    // AVX-512 also needs the opmask and upper ZMM state saved
+    if (has_avx512f && ((xcr0 & 0xE6) == 0xE6))
+        return avx512;
+
+    return avx2;
+}
+
+#else // __SIMPLE_FFT_X86_SIMD
+
+inline StageKernels detectStageKernels()
+{
+    StageKernels scalar = { interleavedStageScalar, splitStageScalar, radix4PassScalar, "scalar" };
+    return scalar;
+}
+
+#endif // __SIMPLE_FFT_X86_SIMD
+
+// The kernels for this CPU, detected once on first use
+inline const StageKernels & getStageKernels()
+{
+    static const StageKernels kernels = detectStageKernels();
+    return kernels;
+}
+
+} // namespace simd
+} // namespace impl
+} // namespace simple_fft
+
+#endif // __SIMPLE_FFT__FFT_SIMD_HPP__